@@ -0,0 +1,158 @@
+// ======================================================================
+//          Copyright Joël Knufman 2021.
+// Distributed under the Boost Software License, Version 1.0.
+//    (See accompanying file LICENSE_1_0.txt or copy at
+//          https://www.boost.org/LICENSE_1_0.txt)
+// ======================================================================
+
+#ifndef Async_Flush
+#define Async_Flush
+#include "hwlib.hpp"
+#include "Matrix.hpp"
+#include <atomic>
+
+/// @file
+
+/// \brief
+/// HT1632C with a flush in the background
+/// \details
+/// flush_async plans the swap like flush does, but instead of clocking the runs out it encodes them,
+/// one after the other, into a transmit bitstream and returns. tick, called from a timer interrupt on the target
+/// or from a simulated tick source on the host, clocks out a few bits of that bitstream and remembers where it stopped.
+/// CS stays low between ticks while a run is not done, the chip does not mind a pause of WR.
+/// So the game logic and the button scan run between the ticks instead of waiting for the bus.
+///
+/// The front buffer takes the planned rows when the transfer starts, so drawing while the transfer runs
+/// only marks rows dirty again: those changes are merged into the next transfer,
+/// which the next flush_async starts as soon as the current one is done.
+/// flush_async returns false while a transfer runs, nothing is lost, the rows stay dirty.
+///
+/// The main loop owns the buffers, tick only reads the transmit bitstream and only while busy,
+/// busy changes with release and acquire so the bitstream is complete before tick sees it.
+/// While busy no other function of the driver may use the bus: wait until busy is false,
+/// for example before initialize or repair. verify_writes is not used by flush_async.
+/// The statistics count the bits and transactions of tick, but no flush time: that is spread over the ticks.
+template< typename Bus, typename Geometry = geometry_16x24 >
+class basic_async_HT1632C : public basic_HT1632C< Bus, Geometry >{
+protected:
+	using base = basic_HT1632C< Bus, Geometry >;
+	using timing = typename Bus::timing;
+	bitstream< Geometry::frame_bits > tx;
+	uint16_t ends[Geometry::addresses / 2];
+	int runs = 0;
+	int run = 0;
+	int position = 0;
+	bool selected = false;
+	std::atomic< bool > active{ false };
+	void (*callback)() = nullptr;
+
+public:
+	using base::base;
+
+/// \brief
+/// starts a flush in the background
+/// \details
+/// Plans the changes and encodes them into the transmit bitstream, nothing is sent yet.
+/// Returns true when a transfer was started, false when nothing changed or a transfer is still running.
+	bool flush_async(){
+		if(active.load(std::memory_order_acquire)){
+			return false;
+		}
+		uint8_t start[Geometry::addresses / 2];
+		uint8_t count[Geometry::addresses / 2];
+		int planned = base::plan(start, count);
+		tx = {};
+		position = 0;
+		run = 0;
+		if(planned < 0){
+			base::encode(tx);
+			runs = 1;
+			ends[0] = Geometry::frame_bits;
+			HT1632C_STATS_ADD(full_flushes, 1);
+		} else {
+			int bits = 0;
+			for(int i = 0; i < planned; i++){
+				base::encodeRun(tx, bits, start[i], count[i]);
+				ends[i] = bits;
+			}
+			runs = planned;
+			HT1632C_STATS_ADD(empty_flushes, runs == 0);
+			HT1632C_STATS_ADD(partial_flushes, runs != 0);
+			HT1632C_STATS_ADD(bits_saved, runs ? Geometry::frame_bits - bits : 0);
+		}
+		base::settle();
+		if(!runs){
+			return false;
+		}
+		active.store(true, std::memory_order_release);
+		return true;
+	}
+
+/// \brief
+/// clocks out up to bits bits of the transfer
+/// \details
+/// Call this from the timer interrupt. A run that is done ends its transaction, the next run starts in the same tick.
+/// When the last run is done the transfer is complete and the callback is called, still from tick.
+/// Returns true while the transfer is not complete.
+	bool tick(int bits = 16){
+		if(!active.load(std::memory_order_acquire)){
+			return false;
+		}
+		while(bits > 0 && run < runs){
+			if(!selected){
+				pin_write(this->b.cs, 0);
+				bus_delay< timing::cs_setup_ns >();
+				selected = true;
+				HT1632C_STATS_ADD(transactions, 1);
+			}
+			int n = ends[run] - position < bits ? ends[run] - position : bits;
+			emit_bits_from< timing >(this->b.write, this->b.data, tx.words, position, n);
+			position += n;
+			bits -= n;
+			HT1632C_STATS_ADD(bits_sent, n);
+			if(position == ends[run]){
+				bus_delay< timing::cs_hold_ns >();
+				pin_write(this->b.cs, 1);
+				selected = false;
+				run++;
+			}
+		}
+		if(run < runs){
+			return true;
+		}
+		active.store(false, std::memory_order_release);
+		if(callback){
+			callback();
+		}
+		return false;
+	}
+
+/// \brief
+/// true while a transfer runs
+	bool busy() const {
+		return active.load(std::memory_order_acquire);
+	}
+
+/// \brief
+/// completes the running transfer right away
+/// \details
+/// Clocks out what is left without waiting for ticks, for when there is no tick source.
+/// With a tick interrupt, wait until busy is false instead, tick and finish must not run at the same time.
+	void finish(){
+		while(tick(Geometry::frame_bits)){}
+	}
+
+/// \brief
+/// sets the function that is called when a transfer is complete
+/// \details
+/// The function is called from tick, so on the target it runs in the timer interrupt.
+	void on_complete(void (*f)()){
+		callback = f;
+	}
+};
+
+/// \brief
+/// HT1632C with a background flush on a bus with runtime polymorphic pins and the datasheet timing
+using async_HT1632C = basic_async_HT1632C< bus >;
+
+#endif
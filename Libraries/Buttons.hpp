@@ -0,0 +1,365 @@
+// ======================================================================
+//          Copyright Joël Knufman 2021.
+// Distributed under the Boost Software License, Version 1.0.
+//    (See accompanying file LICENSE_1_0.txt or copy at
+//          https://www.boost.org/LICENSE_1_0.txt)
+// ======================================================================
+
+#ifndef Buttons
+#define Buttons
+#include "hwlib.hpp"
+#include "SpscQueue.hpp"
+#include <initializer_list>
+
+/// @file
+
+/// \brief
+/// A change of the buttons
+/// \details
+/// stamp is the time of the change in ticks of the clock of the producer,
+/// pressed and released are the buttons that went down and up, state is all buttons that are down after the change.
+struct button_event{
+	uint32_t stamp;
+	uint8_t pressed;
+	uint8_t released;
+	uint8_t state;
+};
+
+/// \brief
+/// Button input through an event queue
+/// \details
+/// Up to 8 buttons, one bit each. The producer, an interrupt handler or a polling loop,
+/// calls sample with the state of all buttons, every change becomes a button_event in a spsc_queue.
+/// The consumer drains the queue with next or buttons.
+///
+/// buttons returns the buttons that are down now and also those that were pressed since the last call,
+/// so a press that starts and ends while the main loop is busy, during a flush or while a result is shown,
+/// still reaches the game.
+/// When the queue is full the change is not accepted, the next sample is compared with the last accepted state,
+/// so the state of the consumer never goes wrong, only a short press can be lost and that is counted in dropped.
+template< int Size = 16 >
+class basic_button_input{
+protected:
+	spsc_queue< button_event, Size > queue;
+	uint8_t last = 0;
+	uint8_t held = 0;
+	uint32_t press_stamp = 0;
+
+public:
+/// \brief
+/// reports the state of the buttons, producer side
+/// \details
+/// Nothing is queued when the state is the same as at the last accepted change.
+	void sample(uint8_t state, uint32_t stamp){
+		if(state == last){
+			return;
+		}
+		if(queue.push(button_event{ stamp, uint8_t(state & ~last), uint8_t(last & ~state), state })){
+			last = state;
+		}
+	}
+
+/// \brief
+/// takes the next change, consumer side
+	bool next(button_event & event){
+		if(!queue.pop(event)){
+			return false;
+		}
+		held = event.state;
+		if(event.pressed){
+			press_stamp = event.stamp;
+		}
+		return true;
+	}
+
+/// \brief
+/// drains the queue, consumer side
+/// \details
+/// Returns the buttons that are down and those that were pressed since the last call, as a mask for game::update.
+	uint8_t buttons(){
+		uint8_t seen = 0;
+		button_event event;
+		while(next(event)){
+			seen |= event.pressed;
+		}
+		return seen | held;
+	}
+
+/// \brief
+/// stamp of the last press the consumer has taken, to measure the latency from a press to its effect
+	uint32_t pressed_at() const {
+		return press_stamp;
+	}
+
+/// \brief
+/// number of changes that were lost because the queue was full
+	uint32_t dropped() const {
+		return queue.dropped();
+	}
+};
+
+/// \brief
+/// Button input with a queue of 16 changes
+using button_input = basic_button_input<>;
+
+/// \brief
+/// Gathers button bits from whole port words
+/// \details
+/// Every button is a bit of a GPIO port and gets a bit in the button mask.
+/// Buttons of the same port whose port bit and mask bit are the same distance apart form one field,
+/// a field is moved into place with one and and one shift. gather then costs one read per port
+/// and a few operations per field, instead of a call and a read per button.
+/// The six buttons of the game are three fields on two ports.
+class port_fields{
+protected:
+	struct field{
+		uint8_t port;
+		int8_t shift;
+		uint32_t mask;
+	};
+
+	field fields[8];
+	int count = 0;
+	uint8_t used = 0;
+
+public:
+/// \brief
+/// adds a button: bit pin of port becomes bit of the mask
+	void add(uint8_t port, uint8_t pin, uint8_t bit){
+		int8_t shift = pin - bit;
+		used |= 0x1U << port;
+		for(int i = 0; i < count; i++){
+			if(fields[i].port == port && fields[i].shift == shift){
+				fields[i].mask |= 0x1U << pin;
+				return;
+			}
+		}
+		if(count < 8){
+			fields[count++] = field{ port, shift, 0x1U << pin };
+		}
+	}
+
+/// \brief
+/// the ports that have buttons, one bit per port
+	uint8_t ports() const {
+		return used;
+	}
+
+/// \brief
+/// the mask of the buttons from the words of the ports, words[n] is port n
+	uint8_t gather(const uint32_t * words) const {
+		uint32_t mask = 0;
+		for(int i = 0; i < count; i++){
+			uint32_t bits = words[fields[i].port] & fields[i].mask;
+			mask |= fields[i].shift >= 0 ? bits >> fields[i].shift : bits << -fields[i].shift;
+		}
+		return mask;
+	}
+};
+
+/// \brief
+/// Debounces 8 inputs at once with vertical counters
+/// \details
+/// Every input has a 2 bit counter, bit 0 of all counters is one byte and bit 1 is another byte,
+/// so update counts for all inputs with a few bitwise operations.
+/// A counter runs while the sample differs from the debounced state and restarts when it is the same again,
+/// the state of an input only changes after 4 samples in a row differ from it.
+/// Sampled every millisecond a press is reported 4 ms after the contact is stable,
+/// bounces that are shorter than that never get through.
+class vertical_debounce{
+protected:
+	uint8_t stable = 0;
+	uint8_t count0 = 0;
+	uint8_t count1 = 0;
+	uint8_t changes = 0;
+
+public:
+/// \brief
+/// adds a sample of all inputs, returns the inputs whose debounced state changed
+	uint8_t update(uint8_t sample){
+		uint8_t delta = sample ^ stable;
+		count1 = (count1 ^ count0) & delta;
+		count0 = ~count0 & delta;
+		changes = delta & ~(count0 | count1);
+		stable ^= changes;
+		return changes;
+	}
+
+/// \brief
+/// the debounced state of all inputs
+	uint8_t state() const {
+		return stable;
+	}
+
+/// \brief
+/// the inputs that went down at the last update
+	uint8_t pressed() const {
+		return changes & stable;
+	}
+
+/// \brief
+/// the inputs that went up at the last update
+	uint8_t released() const {
+		return changes & ~stable;
+	}
+};
+
+#ifdef HWLIB_TARGET_arduino_due
+/// \brief
+/// a button pin and its bit in the button mask
+struct button_pin{
+	hwlib::target::pins pin;
+	uint8_t mask;
+};
+
+/// \brief
+/// starts the DWT cycle counter that stamps the button events
+/// \details
+/// hwlib::now_us can not be called from an interrupt, the cycle counter can. It counts 84 cycles per microsecond.
+inline void due_stamp_enable(){
+	CoreDebug->DEMCR |= CoreDebug_DEMCR_TRCENA_Msk;
+	DWT->CTRL |= DWT_CTRL_CYCCNTENA_Msk;
+}
+
+/// \brief
+/// the current value of the DWT cycle counter
+inline uint32_t due_stamp(){
+	return DWT->CYCCNT;
+}
+
+/// \brief
+/// clears the pending edges of a PIO port, port 0 is PIOA
+/// \details
+/// Reading the interrupt status register clears it. A PIO handler has to do this even when it has nothing to pass the edge to,
+/// otherwise the interrupt comes back right away and the main loop never runs again.
+inline void due_pio_acknowledge(uint32_t port){
+	(void)hwlib::target::port_registers( port ).PIO_ISR;
+}
+
+/// \brief
+/// Arduino Due buttons read as whole ports
+/// \details
+/// The pins are made inputs, read reads the data status register of every port that has buttons once
+/// and gathers the button mask from those words, see port_fields.
+/// All buttons of a port are sampled at the same moment, so the mask is one consistent snapshot.
+class due_port_scanner{
+protected:
+	port_fields fields;
+
+public:
+	due_port_scanner(std::initializer_list< button_pin > pins){
+		for(auto & p : pins){
+			auto info = hwlib::target::pin_info( p.pin );
+			Pio & port = hwlib::target::port_registers( info.port );
+			uint32_t bit = 0x1U << info.pin;
+			PMC->PMC_PCER0 = 1 << ( ID_PIOA + info.port );
+			port.PIO_PER = bit;
+			port.PIO_ODR = bit;
+			for(int b = 0; b < 8; b++){
+				if(p.mask & (0x1U << b)){
+					fields.add(info.port, info.pin, b);
+				}
+			}
+		}
+	}
+
+/// \brief
+/// the ports that have buttons, one bit per port
+	uint8_t ports() const {
+		return fields.ports();
+	}
+
+/// \brief
+/// the state of all buttons, one read per port
+	uint8_t read() const {
+		uint32_t words[4] = {};
+		for(uint32_t port = 0; port < 4; port++){
+			if(fields.ports() & (0x1U << port)){
+				words[port] = hwlib::target::port_registers( port ).PIO_PDSR;
+			}
+		}
+		return fields.gather(words);
+	}
+};
+
+/// \brief
+/// Arduino Due buttons on PIO edge interrupts
+/// \details
+/// Every pin gets the debounce filter of the PIO and an interrupt on both edges.
+/// The filter runs on the slow clock, a level has to be stable for 2 * (divider + 1) slow clock periods,
+/// the default of 160 is about 10 ms. The divider is shared by all pins of a port.
+///
+/// The application defines the handlers of the ports that are used and calls interrupt from them.
+/// The interrupts are enabled by the constructor, before the application can store a pointer to the object,
+/// so a handler that finds no object still clears the edges of its port:
+/// extern "C" void PIOC_Handler(){ if(buttons){ buttons->interrupt(); } else { due_pio_acknowledge(2); } }
+/// All those interrupts get the same priority, so they never interrupt each other and there is one producer.
+/// The constructor takes the first sample before it enables them, so the interrupts are the only producer from then on.
+/// The stamps are cycles of the DWT cycle counter, see due_stamp.
+///
+/// Without the edge interrupts, a due_port_scanner read from a due_timer interrupt and a vertical_debounce
+/// give the same events with a software debounce.
+template< int Size = 16 >
+class basic_due_buttons{
+protected:
+	basic_button_input< Size > & input;
+	due_port_scanner scanner;
+
+public:
+	basic_due_buttons(basic_button_input< Size > & input, std::initializer_list< button_pin > pins, uint32_t divider = 160):
+		input( input ),
+		scanner( pins )
+	{
+		due_stamp_enable();
+		for(auto & p : pins){
+			auto info = hwlib::target::pin_info( p.pin );
+			Pio & port = hwlib::target::port_registers( info.port );
+			uint32_t bit = 0x1U << info.pin;
+			port.PIO_SCDR = divider;
+			port.PIO_DIFSR = bit;
+			port.PIO_IFER = bit;
+			port.PIO_IER = bit;
+		}
+		for(uint32_t port = 0; port < 4; port++){
+			if(scanner.ports() & (0x1U << port)){
+				due_pio_acknowledge(port);
+			}
+		}
+		input.sample(read(), due_stamp());
+		for(uint32_t port = 0; port < 4; port++){
+			if(scanner.ports() & (0x1U << port)){
+				IRQn_Type irq = IRQn_Type( PIOA_IRQn + port );
+				NVIC_SetPriority(irq, 1);
+				NVIC_ClearPendingIRQ(irq);
+				NVIC_EnableIRQ(irq);
+			}
+		}
+	}
+
+/// \brief
+/// the filtered state of all buttons
+	uint8_t read() const {
+		return scanner.read();
+	}
+
+/// \brief
+/// handles a PIO interrupt
+/// \details
+/// Reading the interrupt status of the ports clears their pending edges, then the state of all buttons is sampled.
+/// A port whose interrupt is still pending in the NVIC samples again, that finds no change and queues nothing.
+	void interrupt(){
+		for(uint32_t port = 0; port < 4; port++){
+			if(scanner.ports() & (0x1U << port)){
+				due_pio_acknowledge(port);
+			}
+		}
+		input.sample(read(), due_stamp());
+	}
+};
+
+/// \brief
+/// Arduino Due buttons that feed a button_input
+using due_buttons = basic_due_buttons<>;
+#endif
+
+#endif
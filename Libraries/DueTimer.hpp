@@ -0,0 +1,70 @@
+// ======================================================================
+//          Copyright Joël Knufman 2021.
+// Distributed under the Boost Software License, Version 1.0.
+//    (See accompanying file LICENSE_1_0.txt or copy at
+//          https://www.boost.org/LICENSE_1_0.txt)
+// ======================================================================
+
+#ifndef Due_Timer
+#define Due_Timer
+#include "hwlib.hpp"
+
+/// @file
+
+#ifdef HWLIB_TARGET_arduino_due
+/// \brief
+/// Periodic interrupt from a channel of the Arduino Due timer counters
+/// \details
+/// Channel 0 up to 8 (TC0 channel 0 up to TC2 channel 2) counts MCK / 2 = 42 MHz up to RC and then restarts,
+/// every restart is an interrupt. The application defines the handler, TC0_Handler for channel 0 and so on,
+/// and calls acknowledge in it, otherwise the interrupt comes back right away.
+/// The constructor only sets the channel up, start enables the interrupt and starts counting:
+/// store the pointers the handler uses, to the timer as well, before calling start.
+class due_timer{
+protected:
+	TcChannel & channel;
+	IRQn_Type irq;
+
+	static Tc * block(int number){
+		Tc * blocks[] = { TC0, TC1, TC2 };
+		return blocks[number / 3];
+	}
+
+public:
+/// \brief
+/// sets up a timer that interrupts frequency times per second once it is started
+	due_timer(int number, uint32_t frequency, uint32_t priority = 1):
+		channel( block( number )->TC_CHANNEL[ number % 3 ] ),
+		irq( IRQn_Type( TC0_IRQn + number ) )
+	{
+		uint32_t id = ID_TC0 + number;
+		if(id < 32){
+			PMC->PMC_PCER0 = 0x1U << id;
+		} else {
+			PMC->PMC_PCER1 = 0x1U << (id - 32);
+		}
+		channel.TC_CCR = TC_CCR_CLKDIS;
+		channel.TC_CMR = TC_CMR_TCCLKS_TIMER_CLOCK1 | TC_CMR_WAVE | TC_CMR_WAVSEL_UP_RC;
+		channel.TC_RC = 42000000 / frequency;
+		channel.TC_IER = TC_IER_CPCS;
+		(void)channel.TC_SR;
+		NVIC_SetPriority(irq, priority);
+		NVIC_ClearPendingIRQ(irq);
+	}
+
+/// \brief
+/// enables the interrupt and starts counting
+	void start(){
+		NVIC_EnableIRQ(irq);
+		channel.TC_CCR = TC_CCR_CLKEN | TC_CCR_SWTRG;
+	}
+
+/// \brief
+/// clears the interrupt, call this in the handler
+	void acknowledge(){
+		(void)channel.TC_SR;
+	}
+};
+#endif
+
+#endif
@@ -0,0 +1,309 @@
+// ======================================================================
+//          Copyright Joël Knufman 2021.
+// Distributed under the Boost Software License, Version 1.0.
+//    (See accompanying file LICENSE_1_0.txt or copy at
+//          https://www.boost.org/LICENSE_1_0.txt)
+// ======================================================================
+
+#ifndef Gray_Scale
+#define Gray_Scale
+#include "hwlib.hpp"
+#include "Matrix.hpp"
+#include <atomic>
+
+/// @file
+
+/// \brief
+/// share of a slot the slowest plane switch may take
+/// \details
+/// A switch of 1 / HT1632C_GRAY_SWITCH_SHARE of a slot, define it before including this file to change it.
+#ifndef HT1632C_GRAY_SWITCH_SHARE
+#define HT1632C_GRAY_SWITCH_SHARE 10
+#endif
+
+/// \brief
+/// lowest refresh rate in Hz that a gray configuration may have in the worst case
+/// \details
+/// Below about 100 Hz a display that is switched on and off is seen to flicker.
+/// Define it before including this file to change it.
+#ifndef HT1632C_GRAY_MIN_REFRESH
+#define HT1632C_GRAY_MIN_REFRESH 100
+#endif
+
+/// \brief
+/// worst case time of a plane switch on the bus, in nanoseconds
+/// \details
+/// A full frame, with as many transactions as a switch can have runs, and a PWM command when pwm is true.
+/// Planned runs never cost more bits than a full frame, so no switch takes longer on a bus with this Timing.
+template< typename Timing, typename Geometry >
+constexpr uint64_t ht1632c_gray_switch_ns(bool pwm){
+	constexpr uint64_t bit = Timing::wr_low_ns + Timing::wr_high_ns;
+	constexpr uint64_t transaction = Timing::cs_setup_ns + Timing::cs_hold_ns;
+	return Geometry::frame_bits * bit + Geometry::addresses / 2 * transaction
+		+ (pwm ? (HT1632C_ID_LEN + HT1632C_CMD_LEN + 1) * bit + transaction : 0);
+}
+
+/// \brief
+/// worst case refresh rate of a gray configuration, in Hz
+/// \details
+/// The tick runs as fast as it may: a slot is HT1632C_GRAY_SWITCH_SHARE times the worst case switch,
+/// and a period is period slots. A Timing without delays, like timing_none, gives 0xFFFFFFFF.
+template< typename Timing, typename Geometry >
+constexpr uint32_t ht1632c_gray_refresh_hz(int period, bool pwm){
+	uint64_t ns = ht1632c_gray_switch_ns< Timing, Geometry >(pwm) * HT1632C_GRAY_SWITCH_SHARE * period;
+	return ns ? uint32_t(1000000000ULL / ns) : 0xFFFFFFFF;
+}
+
+/// \brief
+/// HT1632C with gray levels through bit-planes
+/// \details
+/// The chip has one bit per LED, so every pixel gets a level of Bits bits (2 up to 4) that is stored as Bits planes:
+/// plane k holds bit k of every pixel, as a monochrome frame in the order of the display RAM.
+/// The planes are shown one after the other, a pixel is on for a part of the time that is proportional to its level.
+/// tick is called from a timer interrupt (or a simulated tick source on the host) and counts the time in slots:
+/// when the slots of a plane are over it switches to the next plane.
+///
+/// The lowest PwmPlanes planes are weighted with the PWM duty of the chip: they get one slot each
+/// and a duty of 16 >> (PwmPlanes - k) sixteenths. The other planes get a full duty and are weighted with time,
+/// every plane stays twice as long as the plane below it. A period is PwmPlanes + 2^(Bits - PwmPlanes) - 1 slots.
+/// The default is Bits - 1 PWM planes, the shortest period: Bits slots.
+/// When the duty changes the PWM command is sent before the data of the plane, so the new duty covers the whole write.
+/// The brightness command is not used in gray mode.
+///
+/// A switch runs in the interrupt, and while it runs the chip shows a plane that is partly written,
+/// so every switch adds an error of up to its own length to the brightness: up to Bits * switch time / (period() * slot time)
+/// of the full brightness. A switch may take 1 / HT1632C_GRAY_SWITCH_SHARE of a slot, and the refresh rate
+/// of the worst case, where every switch is a full frame, has to be at least HT1632C_GRAY_MIN_REFRESH.
+/// A configuration that can not make that on its Bus does not compile, see ht1632c_gray_refresh_hz.
+/// With the default 1/10 and 100 Hz the worst case switch of the 16 by 24 panel may take 1000 us / period,
+/// which is the time of one bit (wr_low_ns + wr_high_ns, about 400 bits to a frame) at most:
+/// - 2 bits: 1.1 us with 1 PWM plane, 0.72 us with none
+/// - 3 bits: 0.70 us with 2 PWM planes, 0.50 us with 1, 0.24 us with none
+/// - 4 bits: 0.50 us with 3 PWM planes, 0.37 us with 2, 0.19 us with 1, 0.05 us with none
+///
+/// The datasheet timing takes 3.34 us a bit, a full frame 1.4 ms: its worst case is 35 Hz with 2 bits and 1 PWM plane,
+/// 23 Hz with 3 bits and 2 PWM planes and 17 Hz with 4 bits and 3 PWM planes, so it is rejected, and so is timing_conservative.
+/// Gray levels need a bus with a faster Timing, or a lower HT1632C_GRAY_MIN_REFRESH when some flicker is accepted.
+///
+/// A switch has to be fast and always take about the same time, so nothing is planned in tick:
+/// flush_planes plans, for every plane, the runs that turn the previous plane into it (see swap)
+/// and encodes them into a bitstream once. tick only clocks out the bitstream of the next plane,
+/// runs of nibbles where the planes differ, or a full frame when that is cheaper.
+/// There are two sets of bitstreams: flush_planes fills the set that is not shown and hands it over,
+/// tick takes it at the next switch. The first switch of a new set starts from the plane of the old set that is on the chip,
+/// so flush_planes also plans those entry switches. flush_planes returns false while a set is still waiting for tick,
+/// nothing is lost, the levels are taken by the next flush_planes.
+///
+/// The buffers of the monochrome driver are used to plan the switches, do not draw with setPixel and the like in gray mode.
+/// Like for basic_async_HT1632C no other function of the driver may use the bus while the ticks run.
+template< typename Bus, typename Geometry = geometry_16x24, int Bits = 2, int PwmPlanes = Bits - 1 >
+class basic_grayscale_HT1632C : public basic_HT1632C< Bus, Geometry >{
+	static_assert( Bits >= 2 && Bits <= 4, "a gray level has 2 up to 4 bits" );
+	static_assert( PwmPlanes >= 0 && PwmPlanes < Bits, "0 up to Bits - 1 planes can be weighted with the PWM duty" );
+	static_assert( ht1632c_gray_refresh_hz< typename Bus::timing, Geometry >(PwmPlanes + (1 << (Bits - PwmPlanes)) - 1, PwmPlanes > 0)
+		>= HT1632C_GRAY_MIN_REFRESH, "the worst case plane switch on this bus is too slow for a refresh without flicker" );
+protected:
+	using base = basic_HT1632C< Bus, Geometry >;
+	using timing = typename Bus::timing;
+	using row_type = typename Geometry::row_type;
+	static constexpr int rows = Geometry::rows;
+
+	struct plane_stream{
+		bitstream< Geometry::frame_bits > tx;
+		uint16_t ends[Geometry::addresses / 2];
+		int runs;
+	};
+
+	row_type planes[Bits][rows] = {};
+	row_type shown[Bits][rows] = {};
+	plane_stream streams[2][2][Bits] = {};
+	uint8_t slots[Bits];
+	uint8_t duty[Bits];
+	command_sequence< 1 > pwm[Bits];
+	bool changed = false;
+	int active = 0;
+	std::atomic< bool > pending{ false };
+	int current = Bits - 1;
+	int remaining = 1;
+	uint32_t switches = 0;
+
+/// \brief
+/// plans and encodes the switch from one plane to another
+	void build(plane_stream & s, const row_type * from, const row_type * to, uint32_t unknown){
+		uint8_t start[Geometry::addresses / 2];
+		uint8_t count[Geometry::addresses / 2];
+		memcpy(this->front, from, sizeof(this->front));
+		memcpy(this->array, to, sizeof(this->array));
+		this->dirty = Geometry::all_rows;
+		this->resend = unknown;
+		int planned = base::plan(start, count);
+		s.tx = {};
+		if(planned < 0){
+			base::encode(s.tx);
+			s.runs = 1;
+			s.ends[0] = Geometry::frame_bits;
+		} else {
+			int bits = 0;
+			for(int i = 0; i < planned; i++){
+				base::encodeRun(s.tx, bits, start[i], count[i]);
+				s.ends[i] = bits;
+			}
+			s.runs = planned;
+		}
+		base::settle();
+	}
+
+/// \brief
+/// clocks out the runs of a switch, every run in its own transaction
+	void send(const plane_stream & s){
+		int position = 0;
+		for(int i = 0; i < s.runs; i++){
+			basic_writeTransaction< Bus > command(this->b);
+			emit_bits_from< timing >(this->b.write, this->b.data, s.tx.words, position, s.ends[i] - position);
+			HT1632C_STATS_ADD(bits_sent, s.ends[i] - position);
+			position = s.ends[i];
+		}
+	}
+
+public:
+	basic_grayscale_HT1632C(Bus & b):
+		base( b )
+	{
+		for(int k = 0; k < Bits; k++){
+			slots[k] = k < PwmPlanes ? 1 : 1 << (k - PwmPlanes);
+			duty[k] = k < PwmPlanes ? 16 >> (PwmPlanes - k) : 16;
+			pwm[k] = make_commands( uint8_t(HT1632C_CMD_PWMCONTROL | (duty[k] - 1)) );
+		}
+	}
+
+/// \brief
+/// number of gray levels
+	static constexpr int levels = 1 << Bits;
+
+/// \brief
+/// Sets the gray level of a pixel
+/// \details
+/// Level 0 is off and levels - 1 is the brightest, higher levels are cut to the brightest.
+	void setLevel(hwlib::xy xy, uint8_t level){
+		if(!base::inside(xy)) return;
+		level = level < levels ? level : levels - 1;
+		row_type mask = base::com_bit(base::com_of(xy));
+		int row = base::row_of(xy);
+		for(int k = 0; k < Bits; k++){
+			row_type bits = (level >> k) & 1 ? planes[k][row] | mask : planes[k][row] & ~mask;
+			if(bits != planes[k][row]){
+				planes[k][row] = bits;
+				changed = true;
+			}
+		}
+	}
+
+/// \brief
+/// Gets the gray level of a pixel
+/// \details
+/// 0 outside of the matrix.
+	uint8_t getLevel(hwlib::xy xy) const {
+		if(!base::inside(xy)) return 0;
+		uint8_t level = 0;
+		for(int k = 0; k < Bits; k++){
+			if(planes[k][base::row_of(xy)] & base::com_bit(base::com_of(xy))){
+				level |= 1 << k;
+			}
+		}
+		return level;
+	}
+
+/// \brief
+/// Sets all pixels to level 0
+	void clearLevels(){
+		for(int k = 0; k < Bits; k++){
+			for(int i = 0; i < rows; i++){
+				changed |= planes[k][i] != 0;
+				planes[k][i] = 0;
+			}
+		}
+	}
+
+/// \brief
+/// Hands the levels over to tick
+/// \details
+/// Plans and encodes the switches of all planes into the set that is not shown.
+/// Returns true when a new set was handed over, false when nothing changed or the last set was not taken by tick yet.
+/// Rows whose content on the chip is unknown, after initialize or resync, are sent in full by the entry switches.
+	bool flush_planes(){
+		if(!changed || pending.load(std::memory_order_acquire)){
+			return false;
+		}
+		int set = 1 - active;
+		uint32_t unknown = this->resend;
+		for(int k = 0; k < Bits; k++){
+			int previous = k ? k - 1 : Bits - 1;
+			build(streams[set][0][k], planes[previous], planes[k], 0);
+			build(streams[set][1][k], shown[previous], planes[k], unknown);
+		}
+		memcpy(shown, planes, sizeof(shown));
+		changed = false;
+		pending.store(true, std::memory_order_release);
+		return true;
+	}
+
+/// \brief
+/// counts a slot, switches to the next plane when the slots of the current plane are over
+/// \details
+/// Call this from the timer interrupt. Returns true when it switched.
+	bool tick(){
+		if(--remaining > 0){
+			return false;
+		}
+		int previous = current;
+		current = current + 1 == Bits ? 0 : current + 1;
+		int entry = 0;
+		if(pending.load(std::memory_order_acquire)){
+			active = 1 - active;
+			entry = 1;
+			pending.store(false, std::memory_order_release);
+		}
+		if(duty[current] != duty[previous]){
+			base::commands(pwm[current]);
+		}
+		send(streams[active][entry][current]);
+		remaining = slots[current];
+		switches++;
+		return true;
+	}
+
+/// \brief
+/// the plane that is shown
+	int plane() const {
+		return current;
+	}
+
+/// \brief
+/// number of switches so far
+	uint32_t switched() const {
+		return switches;
+	}
+
+/// \brief
+/// number of slots of a whole period
+	static constexpr int period(){
+		return PwmPlanes + (1 << (Bits - PwmPlanes)) - 1;
+	}
+
+/// \brief
+/// brightness of a level
+/// \details
+/// The time a pixel of the level is on during a period, in slots times sixteenths of duty.
+/// period() * 16 is a pixel that is always on at the full duty.
+	uint32_t weight(uint8_t level) const {
+		uint32_t w = 0;
+		for(int k = 0; k < Bits; k++){
+			if((level >> k) & 1){
+				w += slots[k] * duty[k];
+			}
+		}
+		return w;
+	}
+};
+
+#endif
@@ -0,0 +1,225 @@
+// ======================================================================
+//          Copyright Joël Knufman 2021.
+// Distributed under the Boost Software License, Version 1.0.
+//    (See accompanying file LICENSE_1_0.txt or copy at
+//          https://www.boost.org/LICENSE_1_0.txt)
+// ======================================================================
+
+#ifndef Deferred_Log
+#define Deferred_Log
+#include "hwlib.hpp"
+#include "SpscQueue.hpp"
+
+/// @file
+
+// LOG LEVELS //
+/// \brief
+/// nothing is logged
+#define LOG_LEVEL_NONE 0
+/// \brief
+/// errors only
+#define LOG_LEVEL_ERROR 1
+/// \brief
+/// errors and warnings
+#define LOG_LEVEL_WARN 2
+/// \brief
+/// errors, warnings and information
+#define LOG_LEVEL_INFO 3
+/// \brief
+/// everything
+#define LOG_LEVEL_DEBUG 4
+
+/// \brief
+/// the highest level that is logged
+/// \details
+/// Define it before including this file, or on the command line, to change it.
+/// The LOG_ macros of the levels above it expand to nothing, their arguments are not even evaluated.
+#ifndef LOG_LEVEL
+#define LOG_LEVEL LOG_LEVEL_INFO
+#endif
+
+#if LOG_LEVEL >= LOG_LEVEL_ERROR
+#define LOG_ERROR(log, ...) (log).add(LOG_LEVEL_ERROR, __VA_ARGS__)
+#else
+#define LOG_ERROR(log, ...) ((void)0)
+#endif
+
+#if LOG_LEVEL >= LOG_LEVEL_WARN
+#define LOG_WARN(log, ...) (log).add(LOG_LEVEL_WARN, __VA_ARGS__)
+#else
+#define LOG_WARN(log, ...) ((void)0)
+#endif
+
+#if LOG_LEVEL >= LOG_LEVEL_INFO
+#define LOG_INFO(log, ...) (log).add(LOG_LEVEL_INFO, __VA_ARGS__)
+#else
+#define LOG_INFO(log, ...) ((void)0)
+#endif
+
+#if LOG_LEVEL >= LOG_LEVEL_DEBUG
+#define LOG_DEBUG(log, ...) (log).add(LOG_LEVEL_DEBUG, __VA_ARGS__)
+#else
+#define LOG_DEBUG(log, ...) ((void)0)
+#endif
+
+/// \brief
+/// A log record
+/// \details
+/// Nothing is formatted when a record is added: text points to a string literal, which stays in flash,
+/// and the value and the time are stored as numbers. The text is only made when the record is drained.
+/// The time is the 64 bit hwlib::now_us, so it does not wrap and the lines of a long session stay in order.
+struct log_record{
+	const char * text;
+	int32_t value;
+	uint64_t stamp_us;
+	uint8_t level;
+	bool has_value;
+};
+
+/// \brief
+/// Deferred log
+/// \details
+/// add puts a record in a spsc_queue of Size records and returns, it never waits for the serial port.
+/// When the queue is full the record is dropped and counted.
+/// drain sends the records to a Sink while the sink is ready, one character at a time, and returns as soon as it is not:
+/// call it when the loop is idle, it picks up where it stopped. A line looks like
+/// 12.345 I Player 1 has chosen
+/// with the time since the start in seconds, with the milliseconds as 3 decimals, and the first letter of the level. After the queue has run empty,
+/// the number of dropped records is reported in a line of its own.
+///
+/// A Sink has a function bool ready() that tells if a character can be sent without waiting and a function void put(char).
+/// add is meant to be called from the main loop only, it is the single producer of the queue.
+template< int Size = 32 >
+class basic_log{
+protected:
+	spsc_queue< log_record, Size > queue;
+	char line[64];
+	int length = 0;
+	int sent = 0;
+	uint32_t reported = 0;
+
+/// \brief
+/// adds a character to the line, the last place is kept for the newline
+	void append(char c){
+		if(length < int(sizeof(line)) - 1){
+			line[length++] = c;
+		}
+	}
+
+	void append(const char * text){
+		while(*text){
+			append(*text++);
+		}
+	}
+
+	void append(uint32_t value, int min_digits = 1){
+		char digits[10];
+		int n = 0;
+		do{
+			digits[n++] = '0' + value % 10;
+			value /= 10;
+		} while(value || n < min_digits);
+		while(n){
+			append(digits[--n]);
+		}
+	}
+
+	void format(const log_record & r){
+		length = 0;
+		sent = 0;
+		append(uint32_t(r.stamp_us / 1000000));
+		append('.');
+		append(uint32_t(r.stamp_us / 1000 % 1000), 3);
+		append(' ');
+		append("?EWID"[r.level < 5 ? r.level : 0]);
+		append(' ');
+		append(r.text);
+		if(r.has_value){
+			append(' ');
+			if(r.value < 0){
+				append('-');
+			}
+			append(r.value < 0 ? 0U - uint32_t(r.value) : uint32_t(r.value));
+		}
+		line[length++] = '\n';
+	}
+
+public:
+/// \brief
+/// adds a record with a text
+/// \details
+/// text has to stay valid until the record is drained, use a string literal.
+	void add(uint8_t level, const char * text){
+		queue.push(log_record{ text, 0, hwlib::now_us(), level, false });
+	}
+
+/// \brief
+/// adds a record with a text and a number
+	void add(uint8_t level, const char * text, int32_t value){
+		queue.push(log_record{ text, value, hwlib::now_us(), level, true });
+	}
+
+/// \brief
+/// sends log text to a sink while it is ready
+/// \details
+/// Returns true when everything is sent.
+	template< typename Sink >
+	bool drain(Sink & sink){
+		for(;;){
+			while(sent < length){
+				if(!sink.ready()){
+					return false;
+				}
+				sink.put(line[sent++]);
+			}
+			log_record r;
+			if(queue.pop(r)){
+				format(r);
+			} else if(queue.dropped() != reported){
+				length = 0;
+				sent = 0;
+				append("log dropped ");
+				append(queue.dropped() - reported);
+				line[length++] = '\n';
+				reported = queue.dropped();
+			} else {
+				return true;
+			}
+		}
+	}
+
+/// \brief
+/// number of records that were dropped because the queue was full
+	uint32_t dropped() const {
+		return queue.dropped();
+	}
+};
+
+/// \brief
+/// Deferred log of 32 records
+using deferred_log = basic_log<>;
+
+#ifdef HWLIB_TARGET_arduino_due
+/// \brief
+/// Arduino Due serial port as a log sink
+/// \details
+/// The same UART as hwlib::cout, but a character is only written when the transmitter is ready for it,
+/// so a drain never waits: at 9600 baud one character takes about 1 ms.
+/// The constructor writes a newline through hwlib::cout, so hwlib has set up the UART.
+class due_uart_sink{
+public:
+	due_uart_sink(){
+		hwlib::cout << "\n";
+	}
+
+	bool ready() const {
+		return UART->UART_SR & UART_SR_TXRDY;
+	}
+
+	void put(char c){
+		UART->UART_THR = c;
+	}
+};
+#endif
+
+#endif
@@ -8,6 +8,10 @@
 #ifndef Matrix
 #define Matrix
 #include "hwlib.hpp"
+#include "Stats.hpp"
+#include <initializer_list>
+#include <cstring>
+#include <type_traits>
 
 /// @file
 
@@ -81,6 +85,78 @@
 /// \brief
 /// width of the HT1632C 
 #define HT1632C_WIDTH 16 
+/// \brief
+/// number of memory addresses (nibbles) used by one row of the HT1632C
+#define HT1632C_ROW_ADDRESSES (HT1632C_WIDTH / HT1632C_DATA_LEN)
+/// \brief
+/// number of memory addresses (nibbles) of the HT1632C
+#define HT1632C_ADDRESSES (HT1632C_LENGTH * HT1632C_ROW_ADDRESSES)
+/// \brief
+/// number of bits a write transaction needs before the first nibble: the write ID and the address
+#define HT1632C_RUN_OVERHEAD (HT1632C_ID_LEN + HT1632C_ADDRESS_LEN)
+/// \brief
+/// number of bits in a full frame: the write ID, address 0 and all rows
+#define HT1632C_FRAME_BITS (HT1632C_ID_LEN + HT1632C_ADDRESS_LEN + HT1632C_LENGTH * HT1632C_WIDTH)
+/// \brief
+/// dirty mask with a bit set for every row of the HT1632C
+#define HT1632C_ALL_ROWS ((1UL << HT1632C_LENGTH) - 1)
+
+// RAM MAP //
+/// \brief
+/// address of the nibble that holds a ROW and COM line
+/// \details
+/// The display RAM holds one ROW after another, every ROW is coms / 4 nibbles:
+/// 4 nibbles in the 16 COM modes and 2 nibbles in the 8 COM modes.
+constexpr int ht1632c_address(int row, int com, int coms){
+	return row * (coms / HT1632C_DATA_LEN) + com / HT1632C_DATA_LEN;
+}
+
+/// \brief
+/// bit of a COM line in its nibble
+/// \details
+/// The first bit that is clocked in, D0, is the lowest COM line of the nibble and is kept in bit 3.
+constexpr uint8_t ht1632c_bit(int com){
+	return 0x8 >> (com % HT1632C_DATA_LEN);
+}
+
+/// \brief
+/// Panel geometry and COM mode
+/// \details
+/// Width and Height are the size of the panel in pixels, ComMode is the COM option command that initialize sends.
+/// The chip has 24 ROWs of 16 COMs in the 16 COM modes and 32 ROWs of 8 COMs in the 8 COM modes.
+/// On an upright panel the COM lines run along x: the pixel at x, y is ROW y and COM x.
+/// When the panel is as wide as the chip has ROWs, the COM lines run along y: the pixel at x, y is ROW x and COM y,
+/// then the geometry is transposed.
+/// Everything the driver needs to size its buffers and loops is a constant here, and the map is checked at compile time.
+template< int Width, int Height, uint8_t ComMode >
+struct ht1632c_geometry{
+	static constexpr int width = Width;
+	static constexpr int height = Height;
+	static constexpr uint8_t com_mode = ComMode;
+	static constexpr int coms = ( ComMode & 0x04 ) ? 16 : 8;
+	static constexpr int rows = ( ComMode & 0x04 ) ? 24 : 32;
+	static constexpr bool transposed = !( Width == coms && Height == rows );
+	static constexpr int row_addresses = coms / HT1632C_DATA_LEN;
+	static constexpr int addresses = rows * row_addresses;
+	static constexpr int frame_bits = HT1632C_ID_LEN + HT1632C_ADDRESS_LEN + rows * coms;
+	static constexpr uint32_t all_rows = 0xFFFFFFFFUL >> ( 32 - rows );
+	using row_type = typename std::conditional< coms == 16, uint16_t, uint8_t >::type;
+	static constexpr uint32_t row_mask = ( 1UL << coms ) - 1;
+
+	static_assert( ( ComMode & 0xF3 ) == HT1632C_CMD_COMS00, "ComMode has to be one of the COM option commands" );
+	static_assert( ( Width == coms && Height == rows ) || ( Width == rows && Height == coms ),
+		"the panel has to be the COMs by the ROWs of the chip" );
+	static_assert( addresses <= ( 1 << HT1632C_ADDRESS_LEN ), "every nibble needs an address" );
+	static_assert( rows <= 32, "the dirty masks have one bit per ROW" );
+};
+
+/// \brief
+/// the 16 by 24 panel in the N-MOS 16 COM mode
+using geometry_16x24 = ht1632c_geometry< 16, 24, HT1632C_CMD_COMS01 >;
+
+/// \brief
+/// a 32 by 8 board in the N-MOS 8 COM mode
+using geometry_32x8 = ht1632c_geometry< 32, 8, HT1632C_CMD_COMS00 >;
 
 /// \brief
 /// Setup for pins
@@ -177,6 +253,193 @@ public:
     }
 };
 
+/// \brief
+/// Datasheet bus timing
+/// \details
+/// The minimum write-mode timings from the HT1632C AC characteristics at VDD = 3V.
+/// All times are in nanoseconds.
+/// - wr_low_ns is the time WR is held low for every bit.
+/// - wr_high_ns is the time WR is held high after every bit.
+/// - data_setup_ns is the time DATA has to be stable before WR goes high.
+/// - cs_setup_ns is the time between CS going low and the first bit.
+/// - cs_hold_ns is the time between the last bit and CS going high.
+/// - rd_low_ns is the time RD is held low before DATA is sampled, the chip drives DATA after the falling edge.
+/// - rd_high_ns is the time RD is held high after every bit that is read.
+struct timing_datasheet{
+    static constexpr uint32_t wr_low_ns = 1670;
+    static constexpr uint32_t wr_high_ns = 1670;
+    static constexpr uint32_t data_setup_ns = 500;
+    static constexpr uint32_t cs_setup_ns = 500;
+    static constexpr uint32_t cs_hold_ns = 500;
+    static constexpr uint32_t rd_low_ns = 3340;
+    static constexpr uint32_t rd_high_ns = 3340;
+};
+
+/// \brief
+/// Conservative bus timing
+/// \details
+/// About six times slower than the datasheet minimum.
+/// Use this one for long wires or breadboards where the edges are slow.
+struct timing_conservative{
+    static constexpr uint32_t wr_low_ns = 10000;
+    static constexpr uint32_t wr_high_ns = 10000;
+    static constexpr uint32_t data_setup_ns = 5000;
+    static constexpr uint32_t cs_setup_ns = 10000;
+    static constexpr uint32_t cs_hold_ns = 10000;
+    static constexpr uint32_t rd_low_ns = 20000;
+    static constexpr uint32_t rd_high_ns = 20000;
+};
+
+/// \brief
+/// No bus timing
+/// \details
+/// Every delay is 0, so all the waits compile away.
+/// This is meant for host tests with mock pins, a real chip will not keep up.
+struct timing_none{
+    static constexpr uint32_t wr_low_ns = 0;
+    static constexpr uint32_t wr_high_ns = 0;
+    static constexpr uint32_t data_setup_ns = 0;
+    static constexpr uint32_t cs_setup_ns = 0;
+    static constexpr uint32_t cs_hold_ns = 0;
+    static constexpr uint32_t rd_low_ns = 0;
+    static constexpr uint32_t rd_high_ns = 0;
+};
+
+/// \brief
+/// waits a number of nanoseconds
+/// \details
+/// The delay is a template parameter, so a delay of 0 generates no code at all.
+/// On the Arduino Due the wait counts cycles of the DWT cycle counter (84 per microsecond), which is started when it is not running yet.
+/// That is exact to the cycle, and unlike hwlib::wait_ns it does not use the hwlib clock,
+/// so the bus can also be clocked from an interrupt, see basic_async_HT1632C.
+template< uint32_t ns >
+void bus_delay(){
+    if constexpr ( ns > 0 ){
+#ifdef HWLIB_TARGET_arduino_due
+        if(!(DWT->CTRL & DWT_CTRL_CYCCNTENA_Msk)){
+            CoreDebug->DEMCR |= CoreDebug_DEMCR_TRCENA_Msk;
+            DWT->CTRL |= DWT_CTRL_CYCCNTENA_Msk;
+        }
+        uint32_t start = DWT->CYCCNT;
+        while(DWT->CYCCNT - start < (ns * 84 + 999) / 1000){}
+#else
+        hwlib::wait_ns( ns );
+#endif
+    }
+}
+
+/// \brief
+/// writes a pin without a virtual call when possible
+/// \details
+/// When the static type of the pin is a concrete pin class the call is qualified with that class,
+/// so the compiler calls (and can inline) its write directly instead of going through the vtable.
+/// For an abstract type like hwlib::pin_in_out the normal virtual call is used.
+template< typename Pin >
+void pin_write(Pin & pin, bool v){
+    if constexpr ( std::is_abstract< Pin >::value ){
+        pin.write( v );
+    } else {
+        pin.Pin::write( v );
+    }
+}
+
+/// \brief
+/// reads a pin without a virtual call when possible
+/// \details
+/// The pin is refreshed first, then read. Like pin_write the calls are qualified for concrete pin classes.
+template< typename Pin >
+bool pin_read(Pin & pin){
+    if constexpr ( std::is_abstract< Pin >::value ){
+        pin.refresh();
+        return pin.read();
+    } else {
+        pin.Pin::refresh();
+        return pin.Pin::read();
+    }
+}
+
+/// \brief
+/// clocks out a packed bitstream
+/// \details
+/// words holds the bits MSB first, bits is the number of bits to send.
+/// Every bit is clocked out like writeData does, with the delays of the Timing profile,
+/// but the loop only shifts a register instead of building a mask for every bit.
+/// The pin types are template parameters, so for concrete pin types there are no virtual calls at all.
+template< typename Timing, typename WrPin, typename DataPin >
+void emit_bits(WrPin & write, DataPin & data, const uint32_t * words, int bits){
+    constexpr uint32_t low_ns = 
+        Timing::wr_low_ns > Timing::data_setup_ns ? Timing::wr_low_ns : Timing::data_setup_ns;
+    for(; bits > 0; words++, bits -= 32){
+        uint32_t w = *words;
+        for(int n = bits < 32 ? bits : 32; n; n--, w <<= 1){
+            pin_write(write, 0);
+            pin_write(data, w & 0x80000000);
+            bus_delay< low_ns >();
+            pin_write(write, 1);
+            bus_delay< Timing::wr_high_ns >();
+        }
+    }
+}
+
+/// \brief
+/// clocks out a part of a packed bitstream
+/// \details
+/// Like emit_bits, but starts at bit first of words, so a bitstream can be sent a few bits at a time.
+template< typename Timing, typename WrPin, typename DataPin >
+void emit_bits_from(WrPin & write, DataPin & data, const uint32_t * words, int first, int bits){
+    words += first / 32;
+    int skip = first % 32;
+    if(skip && bits > 0){
+        int n = 32 - skip < bits ? 32 - skip : bits;
+        uint32_t w = *words++ << skip;
+        emit_bits< Timing >(write, data, &w, n);
+        bits -= n;
+    }
+    emit_bits< Timing >(write, data, words, bits);
+}
+
+#ifdef HWLIB_TARGET_arduino_due
+/// \brief
+/// Arduino Due pin with direct port register access
+/// \details
+/// A pin that writes the PIO set and clear registers of its port directly.
+/// The class is final and all functions are inline, so when a template like emit_bits knows the pin type
+/// a write is a single store to SODR or CODR.
+class direct_pin final : public hwlib::pin_in_out{
+protected:
+    Pio & port;
+    uint32_t mask;
+public:
+    direct_pin(hwlib::target::pins name):
+        port( hwlib::target::port_registers( hwlib::target::pin_info( name ).port ) ),
+        mask( 0x1U << hwlib::target::pin_info( name ).pin )
+    {
+        PMC->PMC_PCER0 = 1 << ( ID_PIOA + hwlib::target::pin_info( name ).port );
+        port.PIO_PER = mask;
+    }
+    
+    void direction_set_output() override{
+        port.PIO_OER = mask;
+    }
+    
+    void direction_set_input() override{
+        port.PIO_ODR = mask;
+    }
+    
+    void write(bool v) override{
+        ( v ? port.PIO_SODR : port.PIO_CODR ) = mask;
+    }
+    
+    bool read() override{
+        return port.PIO_PDSR & mask;
+    }
+    
+    void flush() override{}
+    void refresh() override{}
+    void direction_flush() override{}
+};
+#endif
+
 /// \brief
 /// SPI Bus Implementation
 /// \details
@@ -184,57 +447,84 @@ public:
 /// The write is used to write clock input.
 /// The data is used to send over data.
 /// The cs pin is the chip select pin.
-/// Pointers are made for the write, data and cs pins.
+/// The rd pin is the read clock, it is only used to read the display RAM back.
+/// When the bus is made without an rd pin, hwlib::pin_in_out_dummy is used and reading is not possible.
+/// References are kept to the write, data, cs and rd pins.
 /// The SPI bus primary function is to create a synchronized serial datalink between two mediums.
-class bus{
-protected:
-   friend class writeTransaction;
+/// The pin types are template parameters, so when they are concrete pin classes (like direct_pin)
+/// every pin operation is resolved at compile time and no virtual calls are made on the hot path.
+/// With hwlib::pin_in_out for all three the bus works with any pin, through virtual calls.
+/// The Timing parameter is one of the timing profiles above, it sets the delays used for every bit.
+template< typename WrPin, typename DataPin, typename CsPin, typename Timing = timing_datasheet, typename RdPin = hwlib::pin_in_out >
+class basic_bus{
 public:
-	hwlib::pin_in_out &write;
-    hwlib::pin_in_out &data;
-    hwlib::pin_in_out &cs;
-    bus(hwlib::pin_in_out &write, hwlib::pin_in_out &data, hwlib::pin_in_out & cs):
+    using timing = Timing;
+    using write_pin = WrPin;
+    using data_pin = DataPin;
+    using cs_pin = CsPin;
+    using rd_pin = RdPin;
+	WrPin &write;
+    DataPin &data;
+    CsPin &cs;
+    RdPin &rd;
+    basic_bus(WrPin &write, DataPin &data, CsPin & cs):
+    write( write ),
+    data ( data ),
+    cs ( cs ),
+    rd ( hwlib::pin_in_out_dummy )
+    {}
+    
+    basic_bus(WrPin &write, DataPin &data, CsPin & cs, RdPin & rd):
     write( write ),
     data ( data ),
-    cs ( cs )
+    cs ( cs ),
+    rd ( rd )
     {}
 	
 /// \brief
 /// sets pins to output
 /// \details
 /// sets Ht1632C Led Matrix pins to output and flushes these pins.
+/// This only has to be done once when the bus is set up, write transactions do not change the direction of the pins.
+/// Only a read transaction turns the data pin around, and it makes it an output again before it ends.
     void set_output(){
         write.direction_set_output();
         data.direction_set_output();
         cs.direction_set_output();
+        rd.direction_set_output();
         write.direction_flush();
         data.direction_flush();
         cs.direction_flush();
+        rd.direction_flush();
     }
 };
 
+/// \brief
+/// SPI bus with runtime polymorphic pins and the datasheet timing
+using bus = basic_bus< hwlib::pin_in_out, hwlib::pin_in_out, hwlib::pin_in_out >;
+
 /// \brief
 /// SPI Transaction
 /// \details
 /// This class takes the SPI bus and creates a transaction from it.
-/// The CS pin starts off high to mark the beginning and ends low to mark the ending.
-/// This class also sets all the pins to output pins.
-class writeTransaction{
+/// The CS pin goes low to mark the beginning and goes high again to mark the ending.
+/// The pins have to be outputs already, see basic_bus::set_output.
+template< typename Bus >
+class basic_writeTransaction{
 protected:
-    bus &b;
-    hwlib::pin_in_out &write;
-    hwlib::pin_in_out &data;
-    hwlib::pin_in_out &cs;
-    friend class bus;
+    using timing = typename Bus::timing;
+    typename Bus::write_pin &write;
+    typename Bus::data_pin &data;
+    typename Bus::cs_pin &cs;
 public:
-    writeTransaction(bus &b):
-        b ( b ),
+    basic_writeTransaction(Bus &b):
         write ( b.write),
         data ( b.data),
         cs ( b.cs )
     {
-        b.set_output();
-        cs.write(0);
+        pin_write(cs, 0);
+        bus_delay< timing::cs_setup_ns >();
+        HT1632C_STATS_ADD(transactions, 1);
     }
     
 /// \brief
@@ -245,54 +535,289 @@ public:
 /// a is the data that is going to be sent.
 /// b stands for a singular bit.
 /// The write is first written low, in preparation to send data, after the data is written the write is turned back to high to actually send over said data.
+/// How long write stays low and high is set by the timing profile of the bus.
 /// the data is written in the following way:
 /// - a and the bit are being used by the AND operator.
 /// - the conditional operator checks if a & bit match, if they do a 1 is written, if they don't a 0 is written.
     void writeData(uint8_t byte_length, uint16_t a){
+        constexpr uint32_t low_ns = 
+            timing::wr_low_ns > timing::data_setup_ns ? timing::wr_low_ns : timing::data_setup_ns;
         for (uint16_t b = 1<<(byte_length-1); b; b >>= 1) {
-            write.write(0);
-            data.write((a & b) ? 1 : 0);
-            hwlib::wait_ms(1);
+            pin_write(write, 0);
+            pin_write(data, (a & b) ? 1 : 0);
+            bus_delay< low_ns >();
 //            hwlib::cout << "Data: " << data.read()<< "\n"; uncomment for debugging
-            write.write(1);
+            pin_write(write, 1);
+            bus_delay< timing::wr_high_ns >();
         }
+        HT1632C_STATS_ADD(bits_sent, byte_length);
     }
 	
+/// \brief
+/// writes a packed bitstream to the bus
+/// \details
+/// words holds the bits MSB first, see emit_bits.
+    void writeBits(const uint32_t * words, int bits){
+        emit_bits< timing >(write, data, words, bits);
+        HT1632C_STATS_ADD(bits_sent, bits);
+    }
+
 /// \brief
 /// Destructor
 /// \details
 /// the CS pin is written high to mark the end of the transaction.
-    ~writeTransaction(){
-        cs.write(1);
+    ~basic_writeTransaction(){
+        bus_delay< timing::cs_hold_ns >();
+        pin_write(cs, 1);
     }
 	
 };
 
+/// \brief
+/// SPI Transaction on a bus with runtime polymorphic pins and the datasheet timing
+using writeTransaction = basic_writeTransaction< bus >;
+
+/// \brief
+/// SPI Read Transaction
+/// \details
+/// A write transaction that can also read data back from the HT1632C.
+/// The read ID and the address are sent with writeData, after that readData clocks bits in with the RD pin.
+/// The first readData turns the data pin into an input, because from then on the chip drives it.
+/// The destructor makes the data pin an output again before CS goes high.
+template< typename Bus >
+class basic_readTransaction : public basic_writeTransaction< Bus >{
+protected:
+    using timing = typename Bus::timing;
+    typename Bus::rd_pin &rd;
+    bool reading = false;
+public:
+    basic_readTransaction(Bus &b):
+        basic_writeTransaction< Bus >( b ),
+        rd ( b.rd )
+    {}
+
+/// \brief
+/// reads data from the bus
+/// \details
+/// Reads byte_length bits, the first bit that is read ends up in the highest bit of the result.
+/// RD is written low and the chip puts the next bit on the data pin, the bit is sampled before RD goes high again.
+/// How long RD stays low and high is set by the timing profile of the bus.
+    uint16_t readData(uint8_t byte_length){
+        if(!reading){
+            this->data.direction_set_input();
+            this->data.direction_flush();
+            reading = true;
+        }
+        uint16_t a = 0;
+        for(uint8_t i = 0; i < byte_length; i++){
+            pin_write(rd, 0);
+            bus_delay< timing::rd_low_ns >();
+            a = (a << 1) | pin_read(this->data);
+            pin_write(rd, 1);
+            bus_delay< timing::rd_high_ns >();
+        }
+        HT1632C_STATS_ADD(bits_read, byte_length);
+        return a;
+    }
+
+/// \brief
+/// Destructor
+/// \details
+/// The data pin becomes an output again, then the write transaction ends.
+    ~basic_readTransaction(){
+        if(reading){
+            this->data.direction_set_output();
+            this->data.direction_flush();
+        }
+    }
+};
+
+/// \brief
+/// SPI Read Transaction on a bus with runtime polymorphic pins and the datasheet timing
+using readTransaction = basic_readTransaction< bus >;
+
+/// \brief
+/// Packed bitstream
+/// \details
+/// Bits bits packed MSB first into 32 bit words, ready to be clocked out by emit_bits.
+/// put appends a value at a bit position and can be used at compile time.
+/// The words have to start zeroed, put only ORs bits in.
+template< int Bits >
+struct bitstream{
+	static constexpr int bits = Bits;
+	uint32_t words[(Bits + 31) / 32];
+	
+	constexpr void put(int & position, uint32_t value, int length){
+		uint64_t shifted = uint64_t(value & (0xFFFFFFFFU >> (32 - length))) << (64 - position % 32 - length);
+		words[position / 32] |= uint32_t(shifted >> 32);
+		if(position % 32 + length > 32){
+			words[position / 32 + 1] |= uint32_t(shifted);
+		}
+		position += length;
+	}
+};
+
+/// \brief
+/// Command sequence
+/// \details
+/// N commands packed into a bitstream at compile time, ready to be sent in one transaction.
+/// The bits are the command mode ID followed by every command as 8 bits and the don't care bit.
+template< int N >
+using command_sequence = bitstream< HT1632C_ID_LEN + N * (HT1632C_CMD_LEN + 1) >;
+
+/// \brief
+/// builds a command sequence
+/// \details
+/// Use it to initialize a constexpr command sequence:
+/// constexpr auto wake = make_commands( HT1632C_CMD_SYSEN, HT1632C_CMD_LEDON );
+template< typename... Commands >
+constexpr command_sequence< sizeof...(Commands) > make_commands(Commands... cmnds){
+	command_sequence< sizeof...(Commands) > seq = {};
+	int position = 0;
+	seq.put(position, HT1632C_ID_COMMAND, HT1632C_ID_LEN);
+	for(uint8_t c : { uint8_t(cmnds)... }){
+		seq.put(position, uint16_t(c) << 1, HT1632C_CMD_LEN + 1);
+	}
+	return seq;
+}
+
+/// \brief
+/// Sprite
+/// \details
+/// A small monochrome image of Height rows and up to 16 columns.
+/// Every row is a 16 bit mask in the same bit order as the HT1632C buffer: the leftmost pixel is bit 15.
+/// Sprites are meant to be constexpr, so they are built at compile time and stored in flash instead of RAM.
+/// They can be written as an initializer list, sprite< 2 >{ 3, { 0xA000, 0x4000 } }, or built from ASCII art with make_sprite.
+template< int Height >
+struct sprite{
+	static constexpr int height = Height;
+	uint8_t width;
+	uint16_t rows[Height];
+};
+
+/// \brief
+/// converts a row of ASCII art to a sprite row
+/// \details
+/// Every character other than '.' and ' ' is a lit pixel, at most 16 characters are used.
+constexpr uint16_t sprite_row(const char * row){
+	uint16_t bits = 0;
+	for(int x = 0; x < 16 && row[x]; x++){
+		if(row[x] != '.' && row[x] != ' '){
+			bits |= 0x8000 >> x;
+		}
+	}
+	return bits;
+}
+
+/// \brief
+/// width of a row of ASCII art, at most 16
+constexpr uint8_t sprite_width(const char * row){
+	uint8_t width = 0;
+	while(width < 16 && row[width]){
+		width++;
+	}
+	return width;
+}
+
+/// \brief
+/// builds a sprite from ASCII art
+/// \details
+/// Every argument is one row of the sprite, the width is the length of the longest row.
+/// Use it to initialize a constexpr sprite:
+/// constexpr auto arrow = make_sprite( "..X.", "XXXX", "..X." );
+template< typename... Rows >
+constexpr sprite< sizeof...(Rows) > make_sprite(const Rows &... rows){
+	uint8_t width = 0;
+	for(uint8_t w : { sprite_width(rows)... }){
+		if(w > width) width = w;
+	}
+	return sprite< sizeof...(Rows) >{ width, { sprite_row(rows)... } };
+}
+
+/// \brief
+/// how a sprite is combined with the buffer
+/// \details
+/// - set ORs the lit pixels of the sprite into the buffer.
+/// - replace overwrites the whole area of the sprite, unlit sprite pixels clear the buffer.
+/// - toggle XORs the lit pixels of the sprite into the buffer.
+enum class blit_mode { set, replace, toggle };
+
+/// \brief
+/// direction of a shift or scroll
+enum class direction { left, right, up, down };
+
 /// \brief
 /// Matrix HT1632C
 /// \details
 /// This is the self-written library for my IPASS project. 
 /// The LED-matrix I'm using has a length of 16 pixels and a width of 24 pixels.
 /// It is controlled by the HT1632 chip. This chip uses a SPI bus.
-/// It has an array of 24 bytes, this array works as a buffer to control the pixels on the led matrix.
-/// It uses friend class bus and writeTransaction, this way these 2 functions can be implemented together.
-class HT1632C : public writeTransaction{
+/// The size of the panel and the COM mode of the chip are set by the Geometry, see ht1632c_geometry.
+/// The default is the 16 by 24 panel in the 16 COM mode, geometry_32x8 is for 32 by 8 boards in the 8 COM mode.
+/// It has an array of one word per ROW, this array works as the back buffer: all drawing is done in it.
+/// The array is kept in the order of the display RAM: word r is ROW r, and COM c is its bit 0x8000 >> c (0x80 >> c in the 8 COM modes),
+/// see buffer_is_ram. The transform from x, y to ROW and COM is done once, in setPixel and the other drawing functions.
+/// Every write is a straight copy of a bit range of the array, nothing is remapped on the way to the chip.
+/// The front array holds what the chip is showing, so a whole frame can be drawn in the back buffer without touching the display.
+/// Every row that may have changed since the last swap has its bit set in dirty,
+/// and the rows in resend are sent no matter what, because their content on the chip is unknown.
+/// When the bus has an rd pin the display RAM can be read back: to verify writes, or to find out
+/// what the chip really shows after a brownout or a glitch, so only the wrong nibbles have to be sent again.
+/// It is a template on the bus type, so the pin types and the timing profile of the bus are known at compile time.
+/// All sizes and loop bounds come from the Geometry, so they are constants and the buffers are exactly as big as the RAM.
+/// The constructor sets up the bus once: the pins become outputs and CS goes high (not selected).
+template< typename Bus, typename Geometry = geometry_16x24 >
+class basic_HT1632C{
+public:
+	using geometry = Geometry;
+	using row_type = typename Geometry::row_type;
+	static constexpr int width = Geometry::width;
+	static constexpr int height = Geometry::height;
 protected:
-	bus &b;
-	hwlib::pin_in_out &write;
-	hwlib::pin_in_out &data;
-	hwlib::pin_in_out &cs;
-	uint16_t array[24] = {0};
-	friend class bus;
-	friend class writeTransaction;
+	static constexpr int rows = Geometry::rows;
+	static constexpr int coms = Geometry::coms;
+	static constexpr int addresses = Geometry::addresses;
+	static constexpr int row_addresses = Geometry::row_addresses;
+	static constexpr bool transposed = Geometry::transposed;
+	Bus &b;
+	row_type array[rows] = {0};
+	row_type front[rows] = {0};
+	uint32_t dirty = 0;
+	uint32_t resend = Geometry::all_rows;
+	bool check = false;
+
+/// \brief
+/// ROW of a pixel
+	static constexpr int row_of(hwlib::xy xy){
+		return transposed ? xy.x : xy.y;
+	}
+
+/// \brief
+/// COM of a pixel
+	static constexpr int com_of(hwlib::xy xy){
+		return transposed ? xy.y : xy.x;
+	}
+
+/// \brief
+/// bit of a COM line in a row word
+	static constexpr row_type com_bit(int com){
+		return row_type((1UL << (coms - 1)) >> com);
+	}
+
+/// \brief
+/// true when a pixel is on the panel
+	static constexpr bool inside(hwlib::xy xy){
+		return (xy.x >= 0) && (xy.x < width) && (xy.y >= 0) && (xy.y < height);
+	}
 public:
-	HT1632C(bus &b):
-		writeTransaction(b),
-		b(b),
-		write(b.write),
-		data(b.data),
-		cs(b.cs)
-		{}
+	basic_HT1632C(Bus &b):
+		b(b)
+	{
+		static_assert( buffer_is_ram(), "the buffer of the matrix has to be in the order of the display RAM" );
+		b.set_output();
+		pin_write(b.cs, 1);
+		pin_write(b.rd, 1);
+	}
 
 /// \brief
 /// send command to LED matrix
@@ -301,25 +826,54 @@ public:
 /// It is used to send commands to the HT1632C chip.	
 /// The standard bit given is to enable the System, which must be on at all times to ensure that changes are actually being made.		
 void cmnd(uint8_t cmnd = 0x01){
-	writeTransaction command(b);
+	basic_writeTransaction< Bus > command(b);
 	command.writeData(12, (((uint16_t)HT1632C_DATA_LEN << 8) | cmnd) << 1 );
+	HT1632C_STATS_ADD(commands, 1);
 }
 
 /// \brief
-/// Initialize LED Matrix
+/// send a batch of commands to LED matrix
+/// \details
+/// The HT1632C accepts any number of commands after one command mode ID.
+/// This function sends the ID once and then all the commands, all within one CS window:
+/// ht.commands({ HT1632C_CMD_SYSEN, HT1632C_CMD_LEDON });
+void commands(std::initializer_list< uint8_t > cmnds){
+	basic_writeTransaction< Bus > command(b);
+	command.writeData(HT1632C_ID_LEN, HT1632C_ID_COMMAND);
+	for(uint8_t c : cmnds){
+		command.writeData(HT1632C_CMD_LEN + 1, uint16_t(c) << 1);
+	}
+	HT1632C_STATS_ADD(commands, cmnds.size());
+}
+
+/// \brief
+/// send a prepacked command sequence to LED matrix
+/// \details
+/// The sequence is made by make_commands at compile time, so only its bits have to be clocked out.
+template< int Bits >
+void commands(const bitstream< Bits > & seq){
+	basic_writeTransaction< Bus > command(b);
+	command.writeBits(seq.words, seq.bits);
+	HT1632C_STATS_ADD(commands, (Bits - HT1632C_ID_LEN) / (HT1632C_CMD_LEN + 1));
+}
+
+/// \brief
+/// commands sent by initialize
 /// \details
-/// Using the cmnd function above, it turns on all the necessary commands for the chip to work.
-/// First of all the system oscillator is turned on. Because the standard bit given is already the byte needed, no byte is given.
+/// First of all the system oscillator is turned on.
 /// Secondly the LED duty cycle generator is turned on. This allows the LEDS to turn on and off.
 /// Thirdly the Blinking effect is turned off, so that we get a still image.
 /// Fourthly the on-chip RC oscillator is turned on.
-/// Lastly the N-MOS open drain output and 16 COM option is selected.
+/// Lastly the COM option of the geometry is selected, N-MOS open drain output and 16 COM for the 16 by 24 panel.
+static constexpr auto initialize_sequence = make_commands(
+	HT1632C_CMD_SYSEN, HT1632C_CMD_LEDON, HT1632C_CMD_BLINKOFF, HT1632C_CMD_INT_RC, Geometry::com_mode );
+
+/// \brief
+/// Initialize LED Matrix
+/// \details
+/// Sends all the necessary commands for the chip to work in one transaction, see initialize_sequence.
 void initialize(){
-	cmnd();
-	cmnd(HT1632C_CMD_LEDON);
-	cmnd(HT1632C_CMD_BLINKOFF);
-	cmnd(HT1632C_CMD_INT_RC);
-	cmnd(HT1632C_CMD_COMS01);	
+	commands(initialize_sequence);
 } 
 
 /// \brief
@@ -335,20 +889,16 @@ void brightness(uint8_t brightness){
 /// \brief
 /// Clears the LED Matrix
 /// \details
-/// This function clears all the LEDS on the LED Matrix.
-/// First off it clears the array and dumps anything that was in it.
-/// Second off the operation write is called upon with the first writeData command.
-/// Third off 0 is being written to all 7 of the memory adresses.
-/// Lastly it writes 0 to all the ROWS and COMS.
+/// This function clears all the LEDS in the buffer, nothing is sent over the bus.
+/// Only the rows that were not empty yet are marked dirty, so the next flush clears exactly those rows.
+/// When the buffer was already empty, the next flush sends nothing at all.
 void clear(){
-	for(int i = 0; i<24; i++){
-	array[i] = 0x00;
-	}
-	writeTransaction command(b);
-	command.writeData(HT1632C_ID_LEN, HT1632C_ID_WRITE);
-	command.writeData(HT1632C_ADDRESS_LEN, 0x00);
-	for(int i = 0; i < 24; i++){
-		command.writeData(16, 0x0000);
+	HT1632C_STATS_ADD(clears, 1);
+	for(int i = 0; i < rows; i++){
+		if(array[i]){
+			array[i] = 0x00;
+			dirty |= 1UL << i;
+		}
 	}
 }
 
@@ -356,32 +906,629 @@ void clear(){
 /// Sets a Pixel on the LED Matrix
 /// \details
 /// This function sets a pixel on the LED matrix using hwlib::xy.
-/// It checks if the x is smaller than 0 or bigger than 15 and it checks if the y is smaller than 0 or bigger than 23.
-/// It creates an x location from 0 to 15 and an y location from 0 to 23.
+/// It checks if the x is smaller than 0 or not smaller than the width, and it checks the y against the height the same way.
+/// The pixel is turned into a ROW and a COM, see row_of and com_of.
 /// A Bitwise OR assignment operator along with a right shift operator is used to modify the array.
+/// The row is only marked dirty when the pixel was not set yet.
 void setPixel(hwlib::xy xy) {
-		if((xy.x < 0) || (xy.x >= HT1632C_WIDTH) || (xy.y < 0) || (xy.y >= HT1632C_LENGTH)) return;
-		array[xy.y] |= 0x8000 >> xy.x;
+		if(!inside(xy)) return;
+		row_type mask = com_bit(com_of(xy));
+		row_type & row = array[row_of(xy)];
+		if(!(row & mask)){
+			row |= mask;
+			dirty |= 1UL << row_of(xy);
+		}
 }
 
+/// \brief
+/// Clears a Pixel on the LED Matrix
+/// \details
+/// The opposite of setPixel: the pixel is turned off in the buffer.
+/// The row is only marked dirty when the pixel was set.
+void clearPixel(hwlib::xy xy) {
+		if(!inside(xy)) return;
+		row_type mask = com_bit(com_of(xy));
+		row_type & row = array[row_of(xy)];
+		if(row & mask){
+			row &= ~mask;
+			dirty |= 1UL << row_of(xy);
+		}
+}
+
+/// \brief
+/// Gets a Pixel of the LED Matrix
+/// \details
+/// The state of the pixel in the back buffer, false outside of the matrix.
+bool getPixel(hwlib::xy xy) const {
+		if(!inside(xy)) return false;
+		return array[row_of(xy)] & com_bit(com_of(xy));
+}
+
+/// \brief
+/// Sets a whole row of the LED Matrix
+/// \details
+/// Row y of the buffer, which is ROW y of the chip, is replaced by bits, COM 0 is the highest bit.
+/// On an upright panel that is row y with the leftmost pixel in the highest bit, on a transposed panel it is column y.
+/// The row is only marked dirty when it changes.
+void setRow(int y, row_type bits){
+		if((y < 0) || (y >= rows)) return;
+		if(array[y] != bits){
+			array[y] = bits;
+			dirty |= 1UL << y;
+		}
+}
+
+/// \brief
+/// Gets a whole row of the LED Matrix
+/// \details
+/// Row y of the back buffer, see setRow. Rows outside the matrix are 0.
+row_type getRow(int y) const {
+		if((y < 0) || (y >= rows)) return 0;
+		return array[y];
+}
+
+/// \brief
+/// Sets a Pixel and shows it immediately
+/// \details
+/// Sets the pixel in the buffer and writes only the nibble that holds it:
+/// the write ID, the address and 4 bits of data, 14 bits instead of the 394 bits of a full frame.
+/// Meant for cursors and indicators that change one pixel at a time.
+void setPixelNow(hwlib::xy xy) {
+		setPixel(xy);
+		writeNibble(xy);
+}
+
+/// \brief
+/// Clears a Pixel and shows it immediately
+/// \details
+/// Like setPixelNow, but the pixel is turned off.
+void clearPixelNow(hwlib::xy xy) {
+		clearPixel(xy);
+		writeNibble(xy);
+}
+
+/// \brief
+/// Draws a sprite
+/// \details
+/// The top left corner of the sprite is placed at x, y and the sprite is combined with the buffer as set by mode.
+/// On an upright panel the clipping is done once for the whole sprite: the visible rows are computed first
+/// and every row is shifted into place, so each row costs one word operation.
+/// On a transposed panel the rows of the sprite are columns of the buffer, so the sprite is drawn pixel by pixel.
+/// Only the rows that actually change are marked dirty.
+template< int Height >
+void blit(const sprite< Height > & s, int x, int y, blit_mode mode = blit_mode::set){
+	if(transposed){
+		for(int i = 0; i < Height; i++){
+			for(int j = 0; j < s.width; j++){
+				hwlib::xy xy(x + j, y + i);
+				bool lit = s.rows[i] & (0x8000 >> j);
+				if(mode == blit_mode::set){
+					if(lit) setPixel(xy);
+				} else if(mode == blit_mode::replace){
+					if(lit) setPixel(xy); else clearPixel(xy);
+				} else if(lit){
+					if(getPixel(xy)) clearPixel(xy); else setPixel(xy);
+				}
+			}
+		}
+		return;
+	}
+	if(x >= width || x <= -16){
+		return;
+	}
+	int first = y < 0 ? -y : 0;
+	int last = y + Height > height ? height - y : Height;
+	uint16_t width_mask = s.width ? 0xFFFF << (16 - s.width) : 0;
+	row_type mask = uint16_t(x >= 0 ? width_mask >> x : width_mask << -x) >> (16 - coms);
+	for(int i = first; i < last; i++){
+		row_type bits = uint16_t(x >= 0 ? s.rows[i] >> x : s.rows[i] << -x) >> (16 - coms);
+		row_type & row = array[y + i];
+		row_type old = row;
+		if(mode == blit_mode::set){
+			row |= bits;
+		} else if(mode == blit_mode::replace){
+			row = (row & ~mask) | (bits & mask);
+		} else {
+			row ^= bits;
+		}
+		if(row != old){
+			dirty |= 1UL << (y + i);
+		}
+	}
+}
+
+/// \brief
+/// mask of count COM lines starting at COM first
+/// \details
+/// The mask is clipped to the COM lines of the chip, COM first is the highest bit of the span.
+static row_type span(int first, int count){
+	int end = first + count;
+	first = first < 0 ? 0 : first;
+	end = end > coms ? coms : end;
+	if(first >= end){
+		return 0;
+	}
+	return (Geometry::row_mask >> first) & ~(Geometry::row_mask >> end);
+}
+
+/// \brief
+/// ORs a mask into count rows starting at row first
+/// \details
+/// The rows are clipped to the matrix, a row is only marked dirty when it changes.
+void setRows(int first, int count, row_type mask){
+	for(int i = first < 0 ? 0 : first; i < first + count && i < rows; i++){
+		if(row_type(array[i] | mask) != array[i]){
+			array[i] |= mask;
+			dirty |= 1UL << i;
+		}
+	}
+}
+
+/// \brief
+/// clears a mask in count rows starting at row first
+/// \details
+/// The opposite of setRows.
+void clearRows(int first, int count, row_type mask){
+	for(int i = first < 0 ? 0 : first; i < first + count && i < rows; i++){
+		if(array[i] & mask){
+			array[i] &= ~mask;
+			dirty |= 1UL << i;
+		}
+	}
+}
+
+/// \brief
+/// Draws a horizontal line
+/// \details
+/// length pixels to the right of start, including start.
+/// On an upright panel this is one OR with a mask, on a transposed panel one bit in length rows.
+void hline(hwlib::xy start, int length){
+	fill_rect(start, hwlib::xy(length, 1));
+}
+
+/// \brief
+/// Draws a vertical line
+/// \details
+/// length pixels down from start, including start. Every row gets one OR with the same mask.
+/// On a transposed panel this is one OR with a mask.
+void vline(hwlib::xy start, int length){
+	fill_rect(start, hwlib::xy(1, length));
+}
+
+/// \brief
+/// Fills a rectangle
+/// \details
+/// The top left corner is start, size is the width and the height. One mask is ORed into every row.
+void fill_rect(hwlib::xy start, hwlib::xy size){
+	if(transposed){
+		setRows(start.x, size.x, span(start.y, size.y));
+	} else {
+		setRows(start.y, size.y, span(start.x, size.x));
+	}
+}
+
+/// \brief
+/// Clears a rectangle
+/// \details
+/// The opposite of fill_rect.
+void clear_rect(hwlib::xy start, hwlib::xy size){
+	if(transposed){
+		clearRows(start.x, size.x, span(start.y, size.y));
+	} else {
+		clearRows(start.y, size.y, span(start.x, size.x));
+	}
+}
+
+/// \brief
+/// Inverts the LED Matrix
+/// \details
+/// Every pixel is toggled, so every row changes and is marked dirty.
+void invert(){
+	for(int i = 0; i < rows; i++){
+		array[i] = ~array[i];
+	}
+	dirty = Geometry::all_rows;
+}
+
+/// \brief
+/// Shifts the LED Matrix
+/// \details
+/// Every pixel moves n pixels in the direction d, the pixels that are shifted out are lost and the new ones are off.
+/// Along the COM lines this is one shift per row, along the ROW lines whole rows are moved.
+/// Only the rows that change are marked dirty.
+void shift(direction d, int n = 1){
+	move(d, n, false);
+}
+
+/// \brief
+/// Scrolls the LED Matrix
+/// \details
+/// Like shift, but the pixels that are shifted out come back in at the other side, for banners that loop.
+void scroll(direction d, int n = 1){
+	move(d, n, true);
+}
+
+protected:
+/// \brief
+/// shift or scroll, see shift
+/// \details
+/// Left and up move pixels towards COM 0 or ROW 0, depending on the direction the COM lines run.
+void move(direction d, int n, bool wrap){
+	if(n <= 0){
+		return;
+	}
+	bool along_coms = transposed ? (d == direction::up || d == direction::down) : (d == direction::left || d == direction::right);
+	bool towards_zero = d == direction::left || d == direction::up;
+	if(along_coms){
+		if(!wrap && n >= coms){
+			clear();
+			return;
+		}
+		n %= coms;
+		for(int i = 0; i < rows; i++){
+			uint32_t row = array[i];
+			uint32_t moved = towards_zero ? row << n : row >> n;
+			if(wrap && n){
+				moved |= towards_zero ? row >> (coms - n) : row << (coms - n);
+			}
+			moved &= Geometry::row_mask;
+			if(moved != row){
+				array[i] = moved;
+				dirty |= 1UL << i;
+			}
+		}
+		return;
+	}
+	if(!wrap && n >= rows){
+		clear();
+		return;
+	}
+	n %= rows;
+	row_type old[rows];
+	memcpy(old, array, sizeof(old));
+	for(int i = 0; i < rows; i++){
+		int from = towards_zero ? i + n : i - n;
+		row_type row = 0;
+		if(from >= 0 && from < rows){
+			row = old[from];
+		} else if(wrap){
+			row = old[(from + rows) % rows];
+		}
+		if(row != array[i]){
+			array[i] = row;
+			dirty |= 1UL << i;
+		}
+	}
+}
+
+public:
+/// \brief
+/// nibble at a memory address of a buffer
+/// \details
+/// Every row word holds coms / 4 nibbles, the first address of a row is in the top 4 bits.
+static constexpr uint8_t nibble(const row_type * buffer, int address){
+	return (buffer[address / row_addresses] >> (coms - HT1632C_DATA_LEN * (address % row_addresses + 1))) & 0xF;
+}
+
+/// \brief
+/// checks that the buffer is the display RAM
+/// \details
+/// For every ROW and COM a buffer with only that pixel set, through com_bit, has to read back through nibble,
+/// the way the driver sends and compares it, as bit ht1632c_bit of nibble ht1632c_address and nothing else.
+/// So the drawing functions, the encoders and the chip agree on the RAM map, it is checked once at compile time.
+static constexpr bool buffer_is_ram(){
+	for(int r = 0; r < rows; r++){
+		for(int c = 0; c < coms; c++){
+			row_type buffer[rows] = {};
+			buffer[r] = com_bit(c);
+			int address = ht1632c_address(r, c, coms);
+			for(int a = 0; a < addresses; a++){
+				if(nibble(buffer, a) != (a == address ? ht1632c_bit(c) : 0)){
+					return false;
+				}
+			}
+		}
+	}
+	return true;
+}
+
+/// \brief
+/// encodes a run of nibbles
+/// \details
+/// Appends the write ID, address and count nibbles of the back buffer to a bitstream.
+/// The back buffer is in RAM order, so the nibbles are one range of bits of the array:
+/// the range is copied into the bitstream a word at a time.
+void encodeRun(bitstream< Geometry::frame_bits > & out, int & position, int address, int count) const {
+	out.put(position, HT1632C_ID_WRITE, HT1632C_ID_LEN);
+	out.put(position, address, HT1632C_ADDRESS_LEN);
+	int bit = address * HT1632C_DATA_LEN;
+	int end = (address + count) * HT1632C_DATA_LEN;
+	while(bit < end){
+		int offset = bit % coms;
+		int length = coms - offset < end - bit ? coms - offset : end - bit;
+		out.put(position, (array[bit / coms] >> (coms - offset - length)) & ((1U << length) - 1), length);
+		bit += length;
+	}
+}
+
+/// \brief
+/// writes a run of nibbles
+/// \details
+/// Sends count nibbles of the back buffer starting at address in one successive address write.
+/// The run is encoded into a bitstream first, see encodeRun, and then clocked out in one go.
+void writeRun(int address, int count){
+	bitstream< Geometry::frame_bits > run = {};
+	int position = 0;
+	encodeRun(run, position, address, count);
+	basic_writeTransaction< Bus > command(b);
+	command.writeBits(run.words, position);
+}
+
+/// \brief
+/// writes the nibble that holds a pixel
+/// \details
+/// Only sends when the nibble differs from the front buffer, the front buffer is updated afterwards.
+void writeNibble(hwlib::xy xy){
+	if(!inside(xy)) return;
+	int row = row_of(xy);
+	int address = ht1632c_address(row, com_of(xy), coms);
+	if(nibble(array, address) == nibble(front, address) && !(resend & (1UL << row))){
+		return;
+	}
+	writeRun(address, 1);
+	row_type mask = 0xF << (coms - HT1632C_DATA_LEN * (address % row_addresses + 1));
+	front[row] = (front[row] & ~mask) | (array[row] & mask);
+}
+
+/// \brief
+/// Swaps the back buffer to the display
+/// \details
+/// The dirty rows of the back buffer are compared with the front buffer nibble by nibble, and a plan is made:
+/// - every changed nibble is the start of a run, a run is sent in one successive address write:
+///   the write ID, the address of the first nibble and then the nibbles, the chip increments the address itself.
+/// - a run costs HT1632C_RUN_OVERHEAD bits more than its nibbles, so two runs with a gap of
+///   at most 2 unchanged nibbles are merged: sending the gap is cheaper than starting a new run.
+/// - a single changed nibble is a run of 1 nibble, 14 bits.
+/// - when the runs together cost as much as a full frame, a full frame is sent instead.
+///
+/// Afterwards the front buffer equals the back buffer, and the back buffer keeps its content for the next frame.
+/// When nothing changed no bus traffic is generated at all.
+/// When verify_writes is on, the sent nibbles are read back and the wrong ones are sent once more.
+void swap(){
+	if(sendChanges() && check){
+		sendChanges();
+	}
+}
+
+/// \brief
+/// Turns verify-after-flush on or off
+/// \details
+/// When on, every swap reads back the nibbles it has sent.
+/// Nibbles that did not arrive right are sent again once, if they are still wrong their rows stay dirty for the next swap.
+/// A read back costs about as many bits as the write, so this doubles the bus time of a swap.
+void verify_writes(bool on){
+	check = on;
+}
+
+/// \brief
+/// reads the display RAM
+/// \details
+/// Reads count nibbles starting at address in one successive address read:
+/// the read ID, the address and then the nibbles, the chip increments the address itself.
+/// Every nibble is stored in its own byte of out, in the same order as in the buffers, so D0 is bit 3.
+void readRam(int address, int count, uint8_t * out){
+	basic_readTransaction< Bus > command(b);
+	command.writeData(HT1632C_ID_LEN, HT1632C_ID_READ);
+	command.writeData(HT1632C_ADDRESS_LEN, address);
+	for(int i = 0; i < count; i++){
+		out[i] = command.readData(HT1632C_DATA_LEN);
+	}
+}
+
+/// \brief
+/// Verifies the display
+/// \details
+/// Reads the whole display RAM and returns the number of nibbles that differ from the front buffer.
+/// Nothing is changed, use resync or repair to fix the differences.
+int verify(){
+	uint8_t chip[addresses];
+	readRam(0, addresses, chip);
+	int wrong = 0;
+	for(int address = 0; address < addresses; address++){
+		if(chip[address] != nibble(front, address)){
+			wrong++;
+		}
+	}
+	return wrong;
+}
+
+/// \brief
+/// Reads the display into the front buffer
+/// \details
+/// After this the front buffer holds what the chip really shows.
+/// Rows where that differs from the back buffer are marked dirty, so the next swap sends only the wrong nibbles.
+/// Returns the number of nibbles that differ from the back buffer.
+int resync(){
+	resend = 0;
+	return readBack(0, addresses);
+}
+
+/// \brief
+/// Repairs the display
+/// \details
+/// A resync followed by a swap: only the corrupted nibbles are sent again.
+/// After a brownout the chip has lost its commands as well, so call initialize first.
+/// Returns the number of nibbles that were wrong.
+int repair(){
+	int wrong = resync();
+	swap();
+	return wrong;
+}
+
+protected:
+/// \brief
+/// reads a run of nibbles into the front buffer
+/// \details
+/// Returns the number of nibbles that differ from the back buffer, their rows are marked dirty.
+int readBack(int address, int count){
+	uint8_t chip[addresses];
+	readRam(address, count, chip);
+	int wrong = 0;
+	for(int i = 0; i < count; i++){
+		int row = (address + i) / row_addresses;
+		int shift = coms - HT1632C_DATA_LEN * ((address + i) % row_addresses + 1);
+		front[row] = (front[row] & ~(0xF << shift)) | (chip[i] << shift);
+		if(chip[i] != nibble(array, address + i)){
+			dirty |= 1UL << row;
+			wrong++;
+		}
+	}
+	return wrong;
+}
+
+/// \brief
+/// plans the runs of a swap
+/// \details
+/// Fills start and count with the runs that bring the chip from the front buffer to the back buffer, see swap.
+/// Returns the number of runs, or -1 when a full frame costs as much as the runs.
+int plan(uint8_t * start, uint8_t * count) const {
+	uint32_t changed = dirty | resend;
+	int runs = 0;
+	int cost = 0;
+	int last = 0;
+	for(int address = 0; address < addresses; address++){
+		uint32_t row = 1UL << (address / row_addresses);
+		if(!(changed & row)){
+			address += row_addresses - 1;
+			continue;
+		}
+		if(!(resend & row) && nibble(array, address) == nibble(front, address)){
+			continue;
+		}
+		int gap = address - last - 1;
+		if(runs && gap * HT1632C_DATA_LEN <= HT1632C_RUN_OVERHEAD){
+			count[runs - 1] += gap + 1;
+			cost += (gap + 1) * HT1632C_DATA_LEN;
+		} else {
+			start[runs] = address;
+			count[runs] = 1;
+			runs++;
+			cost += HT1632C_RUN_OVERHEAD + HT1632C_DATA_LEN;
+		}
+		last = address;
+	}
+	return cost >= Geometry::frame_bits ? -1 : runs;
+}
+
+/// \brief
+/// number of bits the planned runs take on the bus
+static int planned_bits(int runs, const uint8_t * count){
+	int bits = runs * HT1632C_RUN_OVERHEAD;
+	for(int i = 0; i < runs; i++){
+		bits += count[i] * HT1632C_DATA_LEN;
+	}
+	return bits;
+}
+
+/// \brief
+/// marks the planned rows as sent
+/// \details
+/// The front buffer takes the dirty rows of the back buffer, after this nothing is dirty.
+void settle(){
+	uint32_t changed = dirty | resend;
+	for(int row = 0; row < rows; row++){
+		if(changed & (1UL << row)){
+			front[row] = array[row];
+		}
+	}
+	dirty = 0;
+	resend = 0;
+}
+
+/// \brief
+/// sends the planned runs
+/// \details
+/// This is the planner of swap, when check is on the runs are read back afterwards.
+/// Returns the number of nibbles that were read back wrong.
+int sendChanges(){
+	uint8_t start[addresses / 2];
+	uint8_t count[addresses / 2];
+	int runs = plan(start, count);
+	if(runs < 0){
+		flush_all();
+		return check ? readBack(0, addresses) : 0;
+	}
+	for(int i = 0; i < runs; i++){
+		writeRun(start[i], count[i]);
+	}
+	HT1632C_STATS_ADD(empty_flushes, runs == 0);
+	HT1632C_STATS_ADD(partial_flushes, runs != 0);
+	HT1632C_STATS_ADD(bits_saved, runs ? Geometry::frame_bits - planned_bits(runs, count) : 0);
+	settle();
+	int wrong = 0;
+	for(int i = 0; check && i < runs; i++){
+		wrong += readBack(start[i], count[i]);
+	}
+	return wrong;
+}
+
+public:
+
 /// \brief
 /// Flushes the data
 /// \details
-/// All the data in the buffer gets transferred to the permanent memory.
+/// All the data in the buffer that differs from what the display shows gets transferred to the permanent memory.
 /// Once this function is called upon changes actually happen on the LED matrix.
-/// This is because the flush function allows all the commands to be processed.
-/// It does so, because flush is used to synchronize the associated stream buffer with its controlled output sequence.
+/// This is the same as swap().
 void flush(){
-	writeTransaction command(b);
-	command.writeData(HT1632C_ID_LEN, HT1632C_ID_WRITE);
-	command.writeData(HT1632C_ADDRESS_LEN, 0x00);
-	for(int i = 0; i < 24; i++){
-		command.writeData(16, array[i]);
+	HT1632C_STATS_START(start);
+	swap();
+	HT1632C_STATS_STOP(flush_us, start);
+}
+
+/// \brief
+/// Encodes the whole buffer
+/// \details
+/// Packs the write ID, address 0 and all rows of the back buffer into one bitstream.
+void encode(bitstream< Geometry::frame_bits > & frame) const {
+	frame = {};
+	int position = 0;
+	frame.put(position, HT1632C_ID_WRITE, HT1632C_ID_LEN);
+	frame.put(position, 0x00, HT1632C_ADDRESS_LEN);
+	for(int i = 0; i < rows; i++){
+		frame.put(position, array[i], coms);
 	}
 }
 
+/// \brief
+/// Flushes the whole buffer
+/// \details
+/// Sends the ID, address 0 and all rows in one transaction, no matter what the display shows.
+/// The frame is encoded into a bitstream first and then clocked out in one tight loop.
+/// Use this when the content of the chip may have changed, for example after a reset of the chip.
+void flush_all(){
+	bitstream< Geometry::frame_bits > frame;
+	encode(frame);
+	{
+		basic_writeTransaction< Bus > command(b);
+		command.writeBits(frame.words, frame.bits);
+	}
+	HT1632C_STATS_ADD(full_flushes, 1);
+	for(int i = 0; i < rows; i++){
+		front[i] = array[i];
+	}
+	dirty = 0;
+	resend = 0;
+}
+
 };
 
+/// \brief
+/// Matrix HT1632C on a bus with the datasheet timing
+using HT1632C = basic_HT1632C< bus >;
 
+/// \brief
+/// 32 by 8 board in the 8 COM mode on a bus with the datasheet timing
+using HT1632C_32x8 = basic_HT1632C< bus, geometry_32x8 >;
 
 #endif
\ No newline at end of file
@@ -0,0 +1,147 @@
+// ======================================================================
+//          Copyright Joël Knufman 2021.
+// Distributed under the Boost Software License, Version 1.0.
+//    (See accompanying file LICENSE_1_0.txt or copy at
+//          https://www.boost.org/LICENSE_1_0.txt)
+// ======================================================================
+
+#ifndef Matrix_Window
+#define Matrix_Window
+#include "hwlib.hpp"
+#include "Matrix.hpp"
+
+/// @file
+
+/// \brief
+/// hwlib window on a HT1632C
+/// \details
+/// A hwlib::window as big as the panel (16 by 24 pixels by default) on the back buffer of a basic_HT1632C,
+/// so the drawables, fonts and terminals of hwlib can draw on the LED matrix.
+/// Black turns a LED off, every other color turns it on.
+///
+/// hwlib draws lines and rectangles one pixel at a time through the virtual write_implementation.
+/// For those shapes this window has its own functions that work on whole rows with one mask per row:
+/// a horizontal line or a filled rectangle costs one word operation per row instead of one virtual call per pixel.
+/// clear is overridden the same way. Only rows that really change are marked dirty,
+/// and flush is the dirty-aware flush of the matrix, so drawing what is already shown costs no bus traffic.
+template< typename Bus, typename Geometry = geometry_16x24 >
+class basic_matrix_window : public hwlib::window{
+protected:
+	basic_HT1632C< Bus, Geometry > & ht;
+
+/// \brief
+/// turns a rectangle with corners x0, y0 and x1, y1, all included, on or off
+/// \details
+/// This is fill_rect or clear_rect of the matrix: one mask for every row.
+	void area(int x0, int y0, int x1, int y1, bool on){
+		if(x0 > x1){
+			int t = x0; x0 = x1; x1 = t;
+		}
+		if(y0 > y1){
+			int t = y0; y0 = y1; y1 = t;
+		}
+		hwlib::xy start(x0, y0), size(x1 - x0 + 1, y1 - y0 + 1);
+		if(on){
+			ht.fill_rect(start, size);
+		} else {
+			ht.clear_rect(start, size);
+		}
+	}
+
+	void write_implementation(hwlib::xy pos, hwlib::color col) override{
+		if(col == hwlib::black){
+			ht.clearPixel(pos);
+		} else {
+			ht.setPixel(pos);
+		}
+	}
+
+public:
+	using hwlib::window::clear;
+
+	basic_matrix_window(basic_HT1632C< Bus, Geometry > & ht):
+		hwlib::window( hwlib::xy( Geometry::width, Geometry::height ), hwlib::white, hwlib::black ),
+		ht( ht )
+	{}
+
+/// \brief
+/// clears the window to a color
+/// \details
+/// Black clears the buffer of the matrix, every other color turns all LEDs on, one word per row.
+	void clear(hwlib::color col) override{
+		if(col == hwlib::black){
+			ht.clear();
+		} else {
+			ht.fill_rect(hwlib::xy(0, 0), hwlib::xy(Geometry::width, Geometry::height));
+		}
+	}
+
+/// \brief
+/// shows the window on the matrix
+/// \details
+/// This is the flush of the matrix, only the nibbles that changed are sent.
+	void flush() override{
+		ht.flush();
+	}
+
+/// \brief
+/// draws a line from start to end, both included
+/// \details
+/// A horizontal line is one mask on one row, a vertical line one bit on every row.
+/// Other lines are drawn with Bresenham's algorithm, pixel by pixel but without virtual calls.
+	void draw_line(hwlib::xy start, hwlib::xy end, hwlib::color col){
+		bool on = col != hwlib::black;
+		if(start.y == end.y || start.x == end.x){
+			area(start.x, start.y, end.x, end.y, on);
+		} else {
+			int dx = end.x > start.x ? end.x - start.x : start.x - end.x;
+			int dy = end.y > start.y ? start.y - end.y : end.y - start.y;
+			int sx = end.x > start.x ? 1 : -1;
+			int sy = end.y > start.y ? 1 : -1;
+			int error = dx + dy;
+			int x = start.x, y = start.y;
+			for(;;){
+				if(on){
+					ht.setPixel(hwlib::xy(x, y));
+				} else {
+					ht.clearPixel(hwlib::xy(x, y));
+				}
+				if(x == end.x && y == end.y){
+					break;
+				}
+				int e2 = 2 * error;
+				if(e2 >= dy){
+					error += dy;
+					x += sx;
+				}
+				if(e2 <= dx){
+					error += dx;
+					y += sy;
+				}
+			}
+		}
+	}
+
+/// \brief
+/// draws the outline of a rectangle with corners start and end, both included
+	void draw_rectangle(hwlib::xy start, hwlib::xy end, hwlib::color col){
+		draw_line(start, hwlib::xy(end.x, start.y), col);
+		draw_line(hwlib::xy(start.x, end.y), end, col);
+		draw_line(start, hwlib::xy(start.x, end.y), col);
+		draw_line(hwlib::xy(end.x, start.y), end, col);
+	}
+
+/// \brief
+/// fills a rectangle with corners start and end, both included
+/// \details
+/// One mask for every row of the rectangle.
+	void fill_rectangle(hwlib::xy start, hwlib::xy end, hwlib::color col){
+		area(start.x, start.y, end.x, end.y, col != hwlib::black);
+	}
+};
+
+/// \brief
+/// hwlib window on a HT1632C on a bus with runtime polymorphic pins and the datasheet timing
+using matrix_window = basic_matrix_window< bus >;
+
+#endif
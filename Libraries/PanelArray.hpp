@@ -0,0 +1,254 @@
+// ======================================================================
+//          Copyright Joël Knufman 2021.
+// Distributed under the Boost Software License, Version 1.0.
+//    (See accompanying file LICENSE_1_0.txt or copy at
+//          https://www.boost.org/LICENSE_1_0.txt)
+// ======================================================================
+
+#ifndef Panel_Array
+#define Panel_Array
+#include "hwlib.hpp"
+#include "Matrix.hpp"
+
+/// @file
+
+/// \brief
+/// rotation of a panel
+/// \details
+/// The clockwise rotation of a panel in the installation.
+/// With none the panel stands upright: 16 pixels wide and 24 pixels high, with row 0 at the top.
+/// With cw90 and cw270 the panel lies on its side and covers 24 by 16 logical pixels.
+enum class rotation { none, cw90, cw180, cw270 };
+
+/// \brief
+/// place of a panel in the logical framebuffer
+/// \details
+/// x and y are the logical position of the top left corner of the area the panel covers,
+/// r is the rotation of the panel.
+struct panel_place{
+	int16_t x;
+	int16_t y;
+	rotation r;
+
+/// \brief
+/// logical width of the area the panel covers
+	constexpr int width() const {
+		return (r == rotation::cw90 || r == rotation::cw270) ? HT1632C_LENGTH : HT1632C_WIDTH;
+	}
+
+/// \brief
+/// logical height of the area the panel covers
+	constexpr int height() const {
+		return (r == rotation::cw90 || r == rotation::cw270) ? HT1632C_WIDTH : HT1632C_LENGTH;
+	}
+
+/// \brief
+/// true when the panel and the rectangle from x0, y0 up to (not including) x1, y1 overlap
+	constexpr bool overlaps(int x0, int y0, int x1, int y1) const {
+		return x0 < x + width() && x1 > x && y0 < y + height() && y1 > y;
+	}
+
+/// \brief
+/// logical position of a pixel of the panel
+/// \details
+/// px and py are the position of the pixel on the panel itself, as used by basic_HT1632C::setPixel.
+	hwlib::xy logical(int px, int py) const {
+		if(r == rotation::cw90){
+			return hwlib::xy(x + HT1632C_LENGTH - 1 - py, y + px);
+		} else if(r == rotation::cw180){
+			return hwlib::xy(x + HT1632C_WIDTH - 1 - px, y + HT1632C_LENGTH - 1 - py);
+		} else if(r == rotation::cw270){
+			return hwlib::xy(x + py, y + HT1632C_WIDTH - 1 - px);
+		}
+		return hwlib::xy(x + px, y + py);
+	}
+};
+
+/// \brief
+/// Array of HT1632C panels
+/// \details
+/// Several panels that share the WR and DATA pins and each have their own CS pin, so each panel has its own bus.
+/// All drawing is done in one framebuffer of Width by Height pixels in logical coordinates,
+/// every row of it is a number of 16 bit words with the leftmost pixel in the highest bit, like the rows of a panel.
+/// Where every panel is in the framebuffer, and how it is rotated, is set by its panel_place.
+///
+/// Every panel whose area may have changed since the last flush has its bit in dirty.
+/// A flush copies the area of only those panels into their back buffers and swaps them,
+/// so the bus time of a flush grows with the number of changed panels, not with the number of panels.
+/// The panels are made by the user, the array only keeps pointers to them:
+/// basic_PanelArray< bus, 2, 32, 24 > screen({ { &left, { 0, 0, rotation::none } }, { &right, { 16, 0, rotation::none } } });
+template< typename Bus, int N, int Width, int Height >
+class basic_PanelArray{
+	static_assert( N > 0 && N <= 32, "a panel array has 1 up to 32 panels" );
+	static_assert( Width > 0 && Height > 0, "the framebuffer needs at least one pixel" );
+public:
+	using panel = basic_HT1632C< Bus >;
+
+/// \brief
+/// a panel and its place in the framebuffer
+	struct slot{
+		panel * p;
+		panel_place place;
+	};
+
+	static constexpr int width = Width;
+	static constexpr int height = Height;
+
+protected:
+	static constexpr int stride = (Width + 15) / 16;
+	static constexpr uint32_t all_panels = 0xFFFFFFFFUL >> ( 32 - N );
+	slot slots[N];
+	uint16_t buffer[Height][stride] = {};
+	uint32_t dirty = all_panels;
+
+/// \brief
+/// mask of the panels that overlap a rectangle
+	uint32_t panels_in(int x0, int y0, int x1, int y1) const {
+		uint32_t mask = 0;
+		for(int i = 0; i < N; i++){
+			if(slots[i].place.overlaps(x0, y0, x1, y1)){
+				mask |= 1UL << i;
+			}
+		}
+		return mask;
+	}
+
+/// \brief
+/// word of the framebuffer, 0 outside of it
+	uint16_t word(int y, int w) const {
+		if(y < 0 || y >= Height || w < 0 || w >= stride){
+			return 0;
+		}
+		return buffer[y][w];
+	}
+
+/// \brief
+/// 16 pixels of a row starting at x, the pixel at x ends up in the highest bit
+	uint16_t bits16(int x, int y) const {
+		int w = x >> 4;
+		uint32_t pair = (uint32_t(word(y, w)) << 16) | word(y, w + 1);
+		return pair >> (16 - (x & 15));
+	}
+
+/// \brief
+/// copies the area of a panel into its back buffer
+/// \details
+/// An upright panel gets whole rows of 16 pixels at once, a rotated panel is copied pixel by pixel.
+/// setRow only marks the rows that change, so the swap of the panel sends only what really changed.
+	void load(int i){
+		const panel_place & place = slots[i].place;
+		for(int py = 0; py < HT1632C_LENGTH; py++){
+			uint16_t row = 0;
+			if(place.r == rotation::none){
+				row = bits16(place.x, place.y + py);
+			} else {
+				for(int px = 0; px < HT1632C_WIDTH; px++){
+					if(getPixel(place.logical(px, py))){
+						row |= 0x8000 >> px;
+					}
+				}
+			}
+			slots[i].p->setRow(py, row);
+		}
+	}
+
+public:
+	basic_PanelArray(const slot (&s)[N]){
+		for(int i = 0; i < N; i++){
+			slots[i] = s[i];
+		}
+	}
+
+/// \brief
+/// Initializes all panels
+/// \details
+/// Every panel gets the initialize commands, see basic_HT1632C::initialize.
+/// All panels are marked dirty, so the next flush sends every panel its first frame,
+/// also the panels whose area of the framebuffer is never drawn on: their RAM still holds what it had at power on.
+	void initialize(){
+		for(auto & s : slots){
+			s.p->initialize();
+		}
+		dirty = all_panels;
+	}
+
+/// \brief
+/// change brightness of all panels
+	void brightness(uint8_t brightness){
+		for(auto & s : slots){
+			s.p->brightness(brightness);
+		}
+	}
+
+/// \brief
+/// Clears the framebuffer
+/// \details
+/// Nothing is sent over the bus, only the panels that overlap a word that was not empty are marked dirty.
+	void clear(){
+		for(int y = 0; y < Height; y++){
+			for(int w = 0; w < stride; w++){
+				if(buffer[y][w]){
+					buffer[y][w] = 0;
+					dirty |= panels_in(w * 16, y, w * 16 + 16, y + 1);
+				}
+			}
+		}
+	}
+
+/// \brief
+/// Sets a pixel in logical coordinates
+/// \details
+/// The panels that show the pixel are only marked dirty when the pixel was not set yet.
+	void setPixel(hwlib::xy xy){
+		if((xy.x < 0) || (xy.x >= Width) || (xy.y < 0) || (xy.y >= Height)) return;
+		uint16_t mask = 0x8000 >> (xy.x & 15);
+		uint16_t & w = buffer[xy.y][xy.x >> 4];
+		if(!(w & mask)){
+			w |= mask;
+			dirty |= panels_in(xy.x, xy.y, xy.x + 1, xy.y + 1);
+		}
+	}
+
+/// \brief
+/// Clears a pixel in logical coordinates
+/// \details
+/// The opposite of setPixel.
+	void clearPixel(hwlib::xy xy){
+		if((xy.x < 0) || (xy.x >= Width) || (xy.y < 0) || (xy.y >= Height)) return;
+		uint16_t mask = 0x8000 >> (xy.x & 15);
+		uint16_t & w = buffer[xy.y][xy.x >> 4];
+		if(w & mask){
+			w &= ~mask;
+			dirty |= panels_in(xy.x, xy.y, xy.x + 1, xy.y + 1);
+		}
+	}
+
+/// \brief
+/// state of a pixel in logical coordinates, false outside of the framebuffer
+	bool getPixel(hwlib::xy xy) const {
+		if((xy.x < 0) || (xy.x >= Width) || (xy.y < 0) || (xy.y >= Height)) return false;
+		return buffer[xy.y][xy.x >> 4] & (0x8000 >> (xy.x & 15));
+	}
+
+/// \brief
+/// Flushes the dirty panels
+/// \details
+/// The area of every dirty panel is copied into its back buffer and that panel is swapped.
+/// Panels that did not change are not touched, so their CS stays high and they see no bus traffic.
+	void flush(){
+		for(int i = 0; i < N; i++){
+			if(dirty & (1UL << i)){
+				load(i);
+				slots[i].p->flush();
+			}
+		}
+		dirty = 0;
+	}
+};
+
+/// \brief
+/// Array of N panels on buses with runtime polymorphic pins and the datasheet timing
+template< int N, int Width, int Height >
+using PanelArray = basic_PanelArray< bus, N, Width, Height >;
+
+#endif
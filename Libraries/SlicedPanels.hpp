@@ -0,0 +1,255 @@
+// ======================================================================
+//          Copyright Joël Knufman 2021.
+// Distributed under the Boost Software License, Version 1.0.
+//    (See accompanying file LICENSE_1_0.txt or copy at
+//          https://www.boost.org/LICENSE_1_0.txt)
+// ======================================================================
+
+#ifndef Sliced_Panels
+#define Sliced_Panels
+#include "hwlib.hpp"
+#include "Matrix.hpp"
+
+/// @file
+
+/// \brief
+/// transposes an 8 by 8 bit matrix
+/// \details
+/// Every byte of x is a row of the matrix, afterwards every byte is a column.
+/// The bit at row r and column c ends up at row c and column r, in 3 steps of swapping 1x1, 2x2 and 4x4 blocks.
+constexpr uint64_t transpose8(uint64_t x){
+	x = (x & 0xAA55AA55AA55AA55ULL) | ((x & 0x00AA00AA00AA00AAULL) << 7) | ((x >> 7) & 0x00AA00AA00AA00AAULL);
+	x = (x & 0xCCCC3333CCCC3333ULL) | ((x & 0x0000CCCC0000CCCCULL) << 14) | ((x >> 14) & 0x0000CCCC0000CCCCULL);
+	x = (x & 0xF0F0F0F00F0F0F0FULL) | ((x & 0x00000000F0F0F0F0ULL) << 28) | ((x >> 28) & 0x00000000F0F0F0F0ULL);
+	return x;
+}
+
+/// \brief
+/// slices one row of N panels
+/// \details
+/// rows holds the same row of every panel, out gets 16 slices, one for every bit of the row, the leftmost pixel first.
+/// Bit k of a slice is the bit of panel k, so one slice is one port write for all panels.
+/// The 16 by N bit matrix is transposed as two 8 by 8 matrices, one for the high and one for the low bytes.
+template< int N >
+void slice_row(const uint16_t * rows, uint8_t * out){
+	static_assert( N > 0 && N <= 8, "a slice is one byte, so 1 up to 8 panels" );
+	uint64_t high = 0, low = 0;
+	for(int k = 0; k < N; k++){
+		high |= uint64_t(rows[k] >> 8) << (8 * k);
+		low |= uint64_t(rows[k] & 0xFF) << (8 * k);
+	}
+	high = transpose8(high);
+	low = transpose8(low);
+	for(int c = 0; c < 8; c++){
+		out[c] = high >> (56 - 8 * c);
+		out[c + 8] = low >> (56 - 8 * c);
+	}
+}
+
+/// \brief
+/// clocks out slices
+/// \details
+/// Like emit_bits, but every bit is a slice that is written to all data lines at once with one port write.
+/// The data lines all share the same WR clock, so there is one WR toggle for every slice.
+template< typename Timing, typename WrPin, typename Port >
+void emit_slices(WrPin & write, Port & port, const uint8_t * slices, int bits){
+	constexpr uint32_t low_ns =
+		Timing::wr_low_ns > Timing::data_setup_ns ? Timing::wr_low_ns : Timing::data_setup_ns;
+	for(int i = 0; i < bits; i++){
+		pin_write(write, 0);
+		port.write(slices[i]);
+		bus_delay< low_ns >();
+		pin_write(write, 1);
+		bus_delay< Timing::wr_high_ns >();
+	}
+}
+
+#ifdef HWLIB_TARGET_arduino_due
+/// \brief
+/// Arduino Due data lines on consecutive bits of one port
+/// \details
+/// lanes pins starting at first, they have to be consecutive bits of the same PIO port, like d33 up to d40 (PC1 up to PC8).
+/// Only those bits are enabled in the output write status register, so a write to ODSR sets all lanes in one store
+/// and leaves the other pins of the port alone.
+class direct_port{
+protected:
+	Pio & port;
+	uint32_t shift;
+	uint32_t mask;
+public:
+	direct_port(hwlib::target::pins first, int lanes):
+		port( hwlib::target::port_registers( hwlib::target::pin_info( first ).port ) ),
+		shift( hwlib::target::pin_info( first ).pin ),
+		mask( ( ( 0x1U << lanes ) - 1 ) << shift )
+	{
+		PMC->PMC_PCER0 = 1 << ( ID_PIOA + hwlib::target::pin_info( first ).port );
+		port.PIO_PER = mask;
+		port.PIO_OWER = mask;
+	}
+
+	void set_output(){
+		port.PIO_OER = mask;
+	}
+
+	void write(uint32_t lanes){
+		port.PIO_ODSR = lanes << shift;
+	}
+};
+#endif
+
+/// \brief
+/// Bit-sliced HT1632C panels
+/// \details
+/// N panels that share WR and CS, each panel has its own DATA line and all DATA lines are bits of one Port.
+/// The port has a set_output function and a write function that takes the N data bits, bit k for panel k.
+/// Every panel has its own buffer of 24 words, like basic_HT1632C.
+///
+/// A flush transposes the buffers into slices (see slice_row) and clocks them out with one WR toggle per slice,
+/// so N panels are refreshed in the time it takes to refresh one.
+/// The ID and the address are the same for all panels, so those bits are written to every lane.
+/// Only the rows from the first to the last dirty row of all panels are sent, as one run.
+template< typename WrPin, typename CsPin, typename Port, int N, typename Timing = timing_datasheet >
+class basic_sliced_HT1632C{
+	static_assert( N > 0 && N <= 8, "a slice is one byte, so 1 up to 8 panels" );
+protected:
+	WrPin & write;
+	CsPin & cs;
+	Port & port;
+	uint16_t array[24][N] = {};
+	uint32_t dirty = HT1632C_ALL_ROWS;
+	static constexpr uint8_t all = (1U << N) - 1;
+
+/// \brief
+/// adds a value to the slices, every bit goes to all lanes
+	static void broadcast(uint8_t * slices, int & position, uint16_t value, int length){
+		for(int i = length - 1; i >= 0; i--){
+			slices[position++] = (value >> i) & 1 ? all : 0;
+		}
+	}
+
+public:
+	basic_sliced_HT1632C(WrPin & write, CsPin & cs, Port & port):
+		write( write ),
+		cs( cs ),
+		port( port )
+	{
+		write.direction_set_output();
+		cs.direction_set_output();
+		write.direction_flush();
+		cs.direction_flush();
+		port.set_output();
+		pin_write(cs, 1);
+	}
+
+/// \brief
+/// send a prepacked command sequence to all panels
+/// \details
+/// Every bit of the sequence goes to all lanes, so all panels get the same commands.
+	template< int Bits >
+	void commands(const bitstream< Bits > & seq){
+		uint8_t slices[Bits];
+		int position = 0;
+		for(int i = 0; i < Bits; i++){
+			slices[position++] = (seq.words[i / 32] >> (31 - i % 32)) & 1 ? all : 0;
+		}
+		pin_write(cs, 0);
+		bus_delay< Timing::cs_setup_ns >();
+		emit_slices< Timing >(write, port, slices, position);
+		bus_delay< Timing::cs_hold_ns >();
+		pin_write(cs, 1);
+	}
+
+/// \brief
+/// Initialize all panels
+/// \details
+/// Sends the same commands as basic_HT1632C::initialize to all panels at once.
+	void initialize(){
+		commands(basic_HT1632C< bus >::initialize_sequence);
+	}
+
+/// \brief
+/// change brightness of all panels
+	void brightness(uint8_t brightness){
+		commands(make_commands(HT1632C_CMD_PWMCONTROL | (brightness & 0xf)));
+	}
+
+/// \brief
+/// Clears all panels
+/// \details
+/// Only the buffers are cleared, the rows that were not empty are marked dirty.
+	void clear(){
+		for(int y = 0; y < 24; y++){
+			for(int k = 0; k < N; k++){
+				if(array[y][k]){
+					array[y][k] = 0;
+					dirty |= 1UL << y;
+				}
+			}
+		}
+	}
+
+/// \brief
+/// Sets a pixel on a panel
+	void setPixel(int panel, hwlib::xy xy){
+		if((panel < 0) || (panel >= N) || (xy.x < 0) || (xy.x >= HT1632C_WIDTH) || (xy.y < 0) || (xy.y >= HT1632C_LENGTH)) return;
+		uint16_t mask = 0x8000 >> xy.x;
+		if(!(array[xy.y][panel] & mask)){
+			array[xy.y][panel] |= mask;
+			dirty |= 1UL << xy.y;
+		}
+	}
+
+/// \brief
+/// Clears a pixel on a panel
+	void clearPixel(int panel, hwlib::xy xy){
+		if((panel < 0) || (panel >= N) || (xy.x < 0) || (xy.x >= HT1632C_WIDTH) || (xy.y < 0) || (xy.y >= HT1632C_LENGTH)) return;
+		uint16_t mask = 0x8000 >> xy.x;
+		if(array[xy.y][panel] & mask){
+			array[xy.y][panel] &= ~mask;
+			dirty |= 1UL << xy.y;
+		}
+	}
+
+/// \brief
+/// Encodes rows first up to and including last of all panels into slices
+/// \details
+/// Returns the number of slices: the ID, the address of the first row and 16 slices per row.
+	int encode(uint8_t * slices, int first, int last) const {
+		int position = 0;
+		broadcast(slices, position, HT1632C_ID_WRITE, HT1632C_ID_LEN);
+		broadcast(slices, position, first * HT1632C_ROW_ADDRESSES, HT1632C_ADDRESS_LEN);
+		for(int y = first; y <= last; y++){
+			slice_row< N >(array[y], slices + position);
+			position += 16;
+		}
+		return position;
+	}
+
+/// \brief
+/// Flushes all panels at once
+/// \details
+/// The rows from the first to the last dirty row are sliced and sent in one transaction.
+/// When nothing changed no bus traffic is generated at all.
+	void flush(){
+		if(!dirty){
+			return;
+		}
+		int first = 0, last = 23;
+		while(!(dirty & (1UL << first))){
+			first++;
+		}
+		while(!(dirty & (1UL << last))){
+			last--;
+		}
+		uint8_t slices[HT1632C_FRAME_BITS];
+		int bits = encode(slices, first, last);
+		pin_write(cs, 0);
+		bus_delay< Timing::cs_setup_ns >();
+		emit_slices< Timing >(write, port, slices, bits);
+		bus_delay< Timing::cs_hold_ns >();
+		pin_write(cs, 1);
+		dirty = 0;
+	}
+};
+
+#endif
@@ -0,0 +1,76 @@
+// ======================================================================
+//          Copyright Joël Knufman 2021.
+// Distributed under the Boost Software License, Version 1.0.
+//    (See accompanying file LICENSE_1_0.txt or copy at
+//          https://www.boost.org/LICENSE_1_0.txt)
+// ======================================================================
+
+#ifndef Spsc_Queue
+#define Spsc_Queue
+#include <stdint.h>
+#include <atomic>
+
+/// @file
+
+/// \brief
+/// Single producer, single consumer ring buffer
+/// \details
+/// One side (an interrupt handler) pushes, the other side (the main loop) pops, both without locks and without waiting.
+/// head is only written by the producer and tail only by the consumer,
+/// the release stores publish an item before the index that makes it visible.
+/// Both indexes keep counting up, Size is a power of two so an index is masked to a position
+/// and head - tail is the number of items, also after the indexes wrap.
+/// When the buffer is full push drops the item and counts it, an interrupt handler can not wait for the consumer.
+template< typename T, int Size >
+class spsc_queue{
+	static_assert( Size >= 2 && (Size & (Size - 1)) == 0, "the size of the queue is a power of two" );
+protected:
+	T items[Size];
+	std::atomic< uint32_t > head{ 0 };
+	std::atomic< uint32_t > tail{ 0 };
+	std::atomic< uint32_t > lost{ 0 };
+
+public:
+/// \brief
+/// adds an item, producer side
+/// \details
+/// Returns false, and counts the item as dropped, when the queue is full.
+	bool push(const T & item){
+		uint32_t h = head.load(std::memory_order_relaxed);
+		if(h - tail.load(std::memory_order_acquire) == Size){
+			lost.store(lost.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+			return false;
+		}
+		items[h & (Size - 1)] = item;
+		head.store(h + 1, std::memory_order_release);
+		return true;
+	}
+
+/// \brief
+/// takes the oldest item, consumer side
+/// \details
+/// Returns false when the queue is empty.
+	bool pop(T & item){
+		uint32_t t = tail.load(std::memory_order_relaxed);
+		if(t == head.load(std::memory_order_acquire)){
+			return false;
+		}
+		item = items[t & (Size - 1)];
+		tail.store(t + 1, std::memory_order_release);
+		return true;
+	}
+
+/// \brief
+/// true when there is nothing to pop
+	bool empty() const {
+		return tail.load(std::memory_order_relaxed) == head.load(std::memory_order_acquire);
+	}
+
+/// \brief
+/// number of items push had to drop because the queue was full
+	uint32_t dropped() const {
+		return lost.load(std::memory_order_relaxed);
+	}
+};
+
+#endif
@@ -0,0 +1,142 @@
+// ======================================================================
+//          Copyright Joël Knufman 2021.
+// Distributed under the Boost Software License, Version 1.0.
+//    (See accompanying file LICENSE_1_0.txt or copy at
+//          https://www.boost.org/LICENSE_1_0.txt)
+// ======================================================================
+
+#ifndef Display_Stats
+#define Display_Stats
+#include "hwlib.hpp"
+
+/// @file
+
+/// \brief
+/// Histogram with power of 2 buckets
+/// \details
+/// Keeps the number of values, the minimum, the maximum, the total and for every power of 2 how many values were in it:
+/// bucket 0 counts the zeros and bucket k the values from 2^(k-1) up to 2^k - 1.
+/// add costs a few instructions and no division, so it can be used on the hot path.
+/// The counts are 64 bits, a histogram that gets a value on every iteration of the loop does not wrap.
+struct log2_histogram{
+	uint64_t count = 0;
+	uint32_t min = 0xFFFFFFFF;
+	uint32_t max = 0;
+	uint64_t total = 0;
+	uint64_t buckets[33] = {};
+
+/// \brief
+/// bucket of a value
+	static constexpr int bucket(uint32_t value){
+		int k = 0;
+		for(; value; value >>= 1){
+			k++;
+		}
+		return k;
+	}
+
+/// \brief
+/// adds a value
+	void add(uint32_t value){
+		count++;
+		min = value < min ? value : min;
+		max = value > max ? value : max;
+		total += value;
+		buckets[bucket(value)]++;
+	}
+
+/// \brief
+/// prints the histogram, one line for the summary and one line for every bucket that is not empty
+	template< typename Stream >
+	void print(Stream & out, const char * name, const char * unit) const {
+		out << name << ": " << count << " times";
+		if(count){
+			out << ", min " << min << ", mean " << uint32_t(total / count) << ", max " << max << " " << unit;
+		}
+		out << "\n";
+		for(int k = 0; k < 33; k++){
+			if(buckets[k]){
+				out << "  < 2^" << k << " " << unit << ": " << buckets[k] << "\n";
+			}
+		}
+	}
+};
+
+/// \brief
+/// Counters of the display and the game loop
+/// \details
+/// Filled in by the HT1632C_STATS_ hooks in the driver and the main loop.
+/// bits_saved is what the planner saved on the partial flushes, compared with sending a full frame instead:
+/// a flush that sends nothing is only counted in empty_flushes, the main loop may call flush on every iteration.
+/// The counters that grow with every iteration of the loop are 64 bits, so they do not wrap on a device that runs for days.
+struct ht1632c_counters{
+	uint32_t bits_sent = 0;
+	uint32_t bits_read = 0;
+	uint32_t transactions = 0;
+	uint32_t commands = 0;
+	uint32_t full_flushes = 0;
+	uint32_t partial_flushes = 0;
+	uint64_t empty_flushes = 0;
+	uint64_t bits_saved = 0;
+	uint32_t clears = 0;
+	uint64_t loop_iterations = 0;
+	log2_histogram flush_us;
+	log2_histogram loop_us;
+	log2_histogram latency_us;
+
+/// \brief
+/// sets everything back to 0
+	void reset(){
+		*this = ht1632c_counters();
+	}
+
+/// \brief
+/// prints all counters and histograms
+/// \details
+/// This writes a few hundred characters, through hwlib::cout at 9600 baud it takes a few hundred milliseconds,
+/// so only dump on request.
+	template< typename Stream >
+	void dump(Stream & out) const {
+		out << "bits sent: " << bits_sent << "\n";
+		out << "bits read: " << bits_read << "\n";
+		out << "transactions: " << transactions << "\n";
+		out << "commands: " << commands << "\n";
+		out << "flushes: " << full_flushes << " full, " << partial_flushes << " partial, " << empty_flushes << " empty" << "\n";
+		out << "saved by dirty tracking: " << bits_saved << " bits, " << bits_saved / 8 << " bytes" << "\n";
+		out << "clears: " << clears << "\n";
+		out << "loop iterations: " << loop_iterations << "\n";
+		flush_us.print(out, "flush", "us");
+		loop_us.print(out, "loop", "us");
+		latency_us.print(out, "button to display", "us");
+	}
+};
+
+#ifdef HT1632C_STATS
+/// \brief
+/// the counters, only when HT1632C_STATS is defined
+/// \details
+/// HT1632C_STATS has to be the same for the whole program: define it from the build, for example with make STATS=1,
+/// and not in one source file. The hooks are in inline functions and templates of the headers,
+/// two translation units that disagree on it would have different definitions of them and break the one definition rule.
+inline ht1632c_counters ht1632c_stats;
+
+/// \brief
+/// adds n to a counter
+#define HT1632C_STATS_ADD(counter, n) (ht1632c_stats.counter += (n))
+/// \brief
+/// starts a time measurement in a local variable
+#define HT1632C_STATS_START(name) uint_fast64_t name = hwlib::now_us()
+/// \brief
+/// adds the time since HT1632C_STATS_START to a histogram
+#define HT1632C_STATS_STOP(histogram, name) ht1632c_stats.histogram.add(uint32_t(hwlib::now_us() - name))
+/// \brief
+/// adds a value to a histogram
+#define HT1632C_STATS_VALUE(histogram, value) ht1632c_stats.histogram.add(value)
+#else
+#define HT1632C_STATS_ADD(counter, n) ((void)0)
+#define HT1632C_STATS_START(name) ((void)0)
+#define HT1632C_STATS_STOP(histogram, name) ((void)0)
+#define HT1632C_STATS_VALUE(histogram, value) ((void)0)
+#endif
+
+#endif
@@ -0,0 +1,349 @@
+// ======================================================================
+//          Copyright Joël Knufman 2021.
+// Distributed under the Boost Software License, Version 1.0.
+//    (See accompanying file LICENSE_1_0.txt or copy at
+//          https://www.boost.org/LICENSE_1_0.txt)
+// ======================================================================
+
+#ifndef Pin_Trace
+#define Pin_Trace
+#include "hwlib.hpp"
+#include "Matrix.hpp"
+#include "Stats.hpp"
+
+/// @file
+
+/// \brief
+/// ids of the bus pins in a trace
+/// \details
+/// The analyzer and the VCD export expect these ids, give them to the trace_pin of each line.
+enum : uint8_t { TRACE_WR, TRACE_DATA, TRACE_CS, TRACE_RD };
+
+/// \brief
+/// A recorded edge
+/// \details
+/// stamp is the time in ticks of the clock of the trace, pin is the id of the trace_pin and level the new level.
+struct trace_edge{
+	uint32_t stamp;
+	uint8_t pin;
+	bool level;
+};
+
+/// \brief
+/// Trace clock on the hwlib clock
+/// \details
+/// A clock has a start function, a now function that returns ticks and an ns function that turns ticks into nanoseconds.
+/// hwlib::now_ticks can not be used from an interrupt on the Arduino Due, use trace_clock_dwt there.
+struct trace_clock_hwlib{
+	static void start(){}
+
+	static uint32_t now(){
+		return uint32_t(hwlib::now_ticks());
+	}
+
+	static uint64_t ns(uint64_t ticks){
+		return ticks * 1000 / hwlib::ticks_per_us();
+	}
+};
+
+#ifdef HWLIB_TARGET_arduino_due
+/// \brief
+/// Trace clock on the DWT cycle counter of the Arduino Due
+/// \details
+/// 84 ticks per microsecond, and it can be read from an interrupt, so a background flush can be traced too.
+struct trace_clock_dwt{
+	static void start(){
+		CoreDebug->DEMCR |= CoreDebug_DEMCR_TRCENA_Msk;
+		DWT->CTRL |= DWT_CTRL_CYCCNTENA_Msk;
+	}
+
+	static uint32_t now(){
+		return DWT->CYCCNT;
+	}
+
+	static uint64_t ns(uint64_t ticks){
+		return ticks * 1000 / 84;
+	}
+};
+#endif
+
+/// \brief
+/// Ring buffer of recorded edges
+/// \details
+/// Size edges are allocated up front, record stores an edge and moves on: no allocation and no branch on the hot path.
+/// When the buffer is full the oldest edge is overwritten, so the trace always holds the last Size edges
+/// and overwritten tells how many were lost before them.
+/// The stamps are 32 bits, the time between two edges has to be shorter than 2^32 ticks of the Clock.
+template< int Size = 1024, typename Clock = trace_clock_hwlib >
+class pin_trace{
+	static_assert( Size > 0 && (Size & (Size - 1)) == 0, "the size of a pin_trace has to be a power of 2" );
+
+protected:
+	trace_edge edges[Size];
+	uint32_t head = 0;
+
+public:
+	using clock = Clock;
+
+	pin_trace(){
+		Clock::start();
+	}
+
+/// \brief
+/// records an edge now
+	void record(uint8_t pin, bool level){
+		record(pin, level, Clock::now());
+	}
+
+/// \brief
+/// records an edge at a given stamp
+	void record(uint8_t pin, bool level, uint32_t stamp){
+		edges[head++ & (Size - 1)] = trace_edge{ stamp, pin, level };
+	}
+
+/// \brief
+/// number of edges in the trace
+	int size() const {
+		return head < uint32_t(Size) ? int(head) : Size;
+	}
+
+/// \brief
+/// edge i of the trace, 0 is the oldest
+	const trace_edge & operator[](int i) const {
+		return edges[(head - size() + i) & (Size - 1)];
+	}
+
+/// \brief
+/// number of edges that were overwritten
+	uint32_t overwritten() const {
+		return head - size();
+	}
+
+/// \brief
+/// empties the trace
+	void clear(){
+		head = 0;
+	}
+};
+
+/// \brief
+/// Pin that records its edges in a pin_trace
+/// \details
+/// Wraps a pin: every write goes to the pin and a change of level is recorded with the id of the trace_pin.
+/// The first write is always recorded, the level before it is not known.
+/// A read that sees a different level than before is recorded too, at the moment it was read,
+/// so the data the chip drives during a read back shows up in the trace.
+/// The class is final and the Pin type is a template parameter, so in a basic_bus of trace_pins
+/// the calls are still resolved at compile time and a traced flush is only slowed down by record.
+/// It also fits in a pin_setup or a bus of hwlib::pin_in_out, through virtual calls:
+/// \code
+/// pin_trace<> trace;
+/// trace_pin< pin_trace<> > wr(pin_wr, trace, TRACE_WR), data(pin_data, trace, TRACE_DATA), cs(pin_cs, trace, TRACE_CS);
+/// basic_bus< trace_pin< pin_trace<> >, trace_pin< pin_trace<> >, trace_pin< pin_trace<> > > traced(wr, data, cs);
+/// \endcode
+template< typename Trace, typename Pin = hwlib::pin_in_out >
+class trace_pin final : public hwlib::pin_in_out{
+protected:
+	Pin & pin;
+	Trace & trace;
+	uint8_t id;
+	bool level = false;
+	bool known = false;
+
+	void seen(bool v){
+		if(v != level || !known){
+			trace.record(id, v);
+			level = v;
+			known = true;
+		}
+	}
+
+public:
+	trace_pin(Pin & pin, Trace & trace, uint8_t id):
+		pin( pin ),
+		trace( trace ),
+		id( id )
+	{}
+
+	void write(bool v) override{
+		pin_write(pin, v);
+		seen(v);
+	}
+
+	bool read() override{
+		bool v = pin.read();
+		seen(v);
+		return v;
+	}
+
+	void direction_set_input() override{ pin.direction_set_input(); }
+	void direction_set_output() override{ pin.direction_set_output(); }
+	void direction_flush() override{ pin.direction_flush(); }
+	void refresh() override{ pin.refresh(); }
+	void flush() override{ pin.flush(); }
+};
+
+/// \brief
+/// writes a trace as a Value Change Dump
+/// \details
+/// The dump can be opened in GTKWave. The time unit is 1 ns and time 0 is the oldest edge of the trace.
+/// names are the names of the pins by id, a pin gets the character '!' + id as VCD identifier.
+/// A pin is x until its first edge. Edges of pins that have no name are left out.
+template< typename Trace, typename Stream >
+void write_vcd(const Trace & trace, Stream & out, std::initializer_list< const char * > names = { "wr", "data", "cs", "rd" }){
+	out << "$timescale 1ns $end\n";
+	out << "$scope module ht1632c $end\n";
+	uint8_t id = 0;
+	for(auto name : names){
+		out << "$var wire 1 " << char('!' + id++) << " " << name << " $end\n";
+	}
+	out << "$upscope $end\n";
+	out << "$enddefinitions $end\n";
+	out << "#0\n$dumpvars\n";
+	for(uint8_t i = 0; i < id; i++){
+		out << "x" << char('!' + i) << "\n";
+	}
+	out << "$end\n";
+	uint64_t ticks = 0;
+	uint64_t last = 0;
+	for(int i = 0; i < trace.size(); i++){
+		if(i){
+			ticks += uint32_t(trace[i].stamp - trace[i - 1].stamp);
+		}
+		if(trace[i].pin >= id){
+			continue;
+		}
+		uint64_t t = Trace::clock::ns(ticks);
+		if(t != last){
+			out << "#" << t << "\n";
+			last = t;
+		}
+		out << (trace[i].level ? "1" : "0") << char('!' + trace[i].pin) << "\n";
+	}
+}
+
+/// \brief
+/// What analyze_trace found in a trace
+/// \details
+/// A transaction runs from CS going low to CS going high, a gap from CS going high to the next transaction.
+/// The bit rate is the number of bits clocked with WR or RD divided by the time CS was low.
+/// The violations count the edges that came too soon for the timing profile:
+/// - wr_low: WR or RD was low for less than wr_low_ns or rd_low_ns.
+/// - wr_high: the next bit started less than wr_high_ns or rd_high_ns after the WR or RD of the bit before went high.
+/// - data_setup: DATA changed less than data_setup_ns before WR went high.
+/// - cs_setup: the first bit started less than cs_setup_ns after CS went low.
+/// - cs_hold: CS went high less than cs_hold_ns after the last bit.
+struct trace_report{
+	uint32_t transactions = 0;
+	uint32_t bits_written = 0;
+	uint32_t bits_read = 0;
+	uint64_t busy_ns = 0;
+	log2_histogram transaction_ns;
+	log2_histogram gap_ns;
+	uint32_t wr_low = 0;
+	uint32_t wr_high = 0;
+	uint32_t data_setup = 0;
+	uint32_t cs_setup = 0;
+	uint32_t cs_hold = 0;
+
+/// \brief
+/// bits per second while CS was low
+	uint32_t bit_rate() const {
+		return busy_ns ? uint32_t((bits_written + bits_read) * 1000000000ULL / busy_ns) : 0;
+	}
+
+/// \brief
+/// all violations together
+	uint32_t violations() const {
+		return wr_low + wr_high + data_setup + cs_setup + cs_hold;
+	}
+
+/// \brief
+/// prints the report
+	template< typename Stream >
+	void print(Stream & out) const {
+		out << "transactions: " << transactions << ", bits written: " << bits_written << ", bits read: " << bits_read << "\n";
+		out << "bit rate: " << bit_rate() << " bits/s" << "\n";
+		transaction_ns.print(out, "transaction", "ns");
+		gap_ns.print(out, "gap", "ns");
+		out << "violations: " << wr_low << " clock low, " << wr_high << " clock high, " << data_setup << " data setup, "
+			<< cs_setup << " cs setup, " << cs_hold << " cs hold" << "\n";
+	}
+};
+
+/// \brief
+/// analyzes the bus transactions in a trace against a timing profile
+/// \details
+/// The pins have to be traced with the TRACE_ ids. When edges were overwritten the trace can start in a transaction,
+/// that transaction is skipped.
+template< typename Timing, typename Trace >
+trace_report analyze_trace(const Trace & trace){
+	trace_report report;
+	bool selected = false, first = false, gap = false;
+	bool clock[2] = { true, true };
+	uint64_t cs_low = 0, cs_high = 0, clock_low = 0, clock_high = 0, data_change = 0;
+	bool data_changed = false, last_rd = false;
+	uint64_t ticks = 0;
+	for(int i = 0; i < trace.size(); i++){
+		const trace_edge & e = trace[i];
+		if(i){
+			ticks += uint32_t(e.stamp - trace[i - 1].stamp);
+		}
+		uint64_t t = Trace::clock::ns(ticks);
+		if(e.pin == TRACE_CS){
+			if(!e.level && !selected){
+				selected = true;
+				first = true;
+				cs_low = t;
+				if(gap){
+					report.gap_ns.add(uint32_t(t - cs_high));
+				}
+			} else if(e.level && selected){
+				selected = false;
+				report.transactions++;
+				report.busy_ns += t - cs_low;
+				report.transaction_ns.add(uint32_t(t - cs_low));
+				if(!first && t - clock_high < Timing::cs_hold_ns){
+					report.cs_hold++;
+				}
+				cs_high = t;
+				gap = true;
+			}
+		} else if(e.pin == TRACE_DATA){
+			data_change = t;
+			data_changed = true;
+		} else if((e.pin == TRACE_WR || e.pin == TRACE_RD) && selected){
+			bool rd = e.pin == TRACE_RD;
+			if(e.level == clock[rd]){
+				continue;
+			}
+			clock[rd] = e.level;
+			if(!e.level){
+				if(first){
+					if(t - cs_low < Timing::cs_setup_ns){
+						report.cs_setup++;
+					}
+				} else if(t - clock_high < (last_rd ? Timing::rd_high_ns : Timing::wr_high_ns)){
+					report.wr_high++;
+				}
+				first = false;
+				clock_low = t;
+			} else {
+				if(t - clock_low < (rd ? Timing::rd_low_ns : Timing::wr_low_ns)){
+					report.wr_low++;
+				}
+				if(!rd && data_changed && t - data_change < Timing::data_setup_ns){
+					report.data_setup++;
+				}
+				(rd ? report.bits_read : report.bits_written)++;
+				clock_high = t;
+				last_rd = rd;
+			}
+		} else if(e.pin == TRACE_WR || e.pin == TRACE_RD){
+			clock[e.pin == TRACE_RD] = e.level;
+		}
+	}
+	return report;
+}
+
+#endif
@@ -0,0 +1,161 @@
+// ======================================================================
+//          Copyright Joël Knufman 2021.
+// Distributed under the Boost Software License, Version 1.0.
+//    (See accompanying file LICENSE_1_0.txt or copy at
+//          https://www.boost.org/LICENSE_1_0.txt)
+// ======================================================================
+
+#ifndef Game
+#define Game
+#include <stdint.h>
+
+/// @file
+
+// BUTTON MASKS //
+/// \brief
+/// rock button of player 1
+#define BUTTON_STEEN_P1 0x01
+/// \brief
+/// paper button of player 1
+#define BUTTON_PAPIER_P1 0x02
+/// \brief
+/// scissors button of player 1
+#define BUTTON_SCHAAR_P1 0x04
+/// \brief
+/// rock button of player 2
+#define BUTTON_STEEN_P2 0x08
+/// \brief
+/// paper button of player 2
+#define BUTTON_PAPIER_P2 0x10
+/// \brief
+/// scissors button of player 2
+#define BUTTON_SCHAAR_P2 0x20
+/// \brief
+/// all buttons of player 1
+#define BUTTONS_P1 (BUTTON_STEEN_P1 | BUTTON_PAPIER_P1 | BUTTON_SCHAAR_P1)
+/// \brief
+/// all buttons of player 2
+#define BUTTONS_P2 (BUTTON_STEEN_P2 | BUTTON_PAPIER_P2 | BUTTON_SCHAAR_P2)
+
+/// \brief
+/// choice of a player
+enum class choice : uint8_t { none, steen, papier, schaar };
+
+/// \brief
+/// result of a round
+enum class result : uint8_t { none, p1, p2, draw };
+
+/// \brief
+/// What the main loop has to do after an update
+/// \details
+/// p1_chosen and p2_chosen acknowledge the choice of a player.
+/// show is the result that has to be drawn, or result::none.
+/// clear is set when the result has been shown long enough and the display has to be cleared.
+struct game_events{
+	bool p1_chosen = false;
+	bool p2_chosen = false;
+	result show = result::none;
+	bool clear = false;
+};
+
+/// \brief
+/// Rock paper scissors round logic
+/// \details
+/// The rounds are an explicit state machine that never waits.
+/// update() is called in every iteration of the main loop with the current time from hwlib::now_us() and the pressed buttons,
+/// it changes state when needed and returns what the main loop has to do.
+/// Because the time is passed in, the state machine can be tested on the host with a simulated clock.
+/// The states are:
+/// - waiting: every player can choose once, the first pressed button of a player counts.
+///   Once both players have chosen the result is returned and the state becomes showing_result.
+/// - showing_result: the result stays on the display for result_us, buttons are ignored.
+/// - cooldown: the display is cleared, a new round starts after cooldown_us once all buttons are released,
+///   so a button that is still held down does not choose for the next round.
+class game{
+public:
+	enum class state { waiting, showing_result, cooldown };
+	
+protected:
+	uint_fast64_t result_us;
+	uint_fast64_t cooldown_us;
+	state current = state::waiting;
+	uint_fast64_t deadline = 0;
+	choice p1 = choice::none;
+	choice p2 = choice::none;
+	
+	static choice pressed(uint8_t buttons, uint8_t steen, uint8_t papier, uint8_t schaar){
+		if(buttons & steen) return choice::steen;
+		if(buttons & papier) return choice::papier;
+		if(buttons & schaar) return choice::schaar;
+		return choice::none;
+	}
+	
+public:
+	game(uint_fast64_t result_us = 2000000, uint_fast64_t cooldown_us = 10000):
+		result_us( result_us ),
+		cooldown_us( cooldown_us )
+	{}
+
+/// \brief
+/// decides who wins
+/// \details
+/// Rock beats scissors, paper beats rock and scissors beat paper.
+/// Returns result::none as long as one of the players has not chosen.
+	static result winner(choice p1, choice p2){
+		if(p1 == choice::none || p2 == choice::none) return result::none;
+		if(p1 == p2) return result::draw;
+		if( (p1 == choice::steen && p2 == choice::schaar) || (p1 == choice::papier && p2 == choice::steen)
+		 || (p1 == choice::schaar && p2 == choice::papier) ){
+			return result::p1;
+		}
+		return result::p2;
+	}
+
+/// \brief
+/// advances the round
+/// \details
+/// now_us is a monotonic time in microseconds, buttons is a mask of the BUTTON_ defines that are pressed.
+	game_events update(uint_fast64_t now_us, uint8_t buttons){
+		game_events events;
+		switch(current){
+			case state::waiting:
+				if(p1 == choice::none){
+					p1 = pressed(buttons, BUTTON_STEEN_P1, BUTTON_PAPIER_P1, BUTTON_SCHAAR_P1);
+					events.p1_chosen = p1 != choice::none;
+				}
+				if(p2 == choice::none){
+					p2 = pressed(buttons, BUTTON_STEEN_P2, BUTTON_PAPIER_P2, BUTTON_SCHAAR_P2);
+					events.p2_chosen = p2 != choice::none;
+				}
+				events.show = winner(p1, p2);
+				if(events.show != result::none){
+					current = state::showing_result;
+					deadline = now_us + result_us;
+				}
+				break;
+			case state::showing_result:
+				if(now_us >= deadline){
+					current = state::cooldown;
+					deadline = now_us + cooldown_us;
+					p1 = choice::none;
+					p2 = choice::none;
+					events.clear = true;
+				}
+				break;
+			case state::cooldown:
+				if(now_us >= deadline && buttons == 0){
+					current = state::waiting;
+				}
+				break;
+		}
+		return events;
+	}
+	
+/// \brief
+/// current state of the round
+	state status() const {
+		return current;
+	}
+};
+
+#endif
@@ -1,225 +1,268 @@
+// Build with make STATS=1 to measure the display and the loop, then type s on the serial port for a dump.
 #include "hwlib.hpp"
 #include "Matrix.hpp"
+#include "AsyncFlush.hpp"
+#include "Game.hpp"
+#include "Buttons.hpp"
+#include "DueTimer.hpp"
+#include "Log.hpp"
+
+// The display pins write the port registers directly, the bus knows their type so no virtual calls are made.
+using display_bus = basic_bus< direct_pin, direct_pin, direct_pin, timing_datasheet, direct_pin >;
+// The display is flushed in the background by a timer interrupt.
+using display = basic_async_HT1632C< display_bus >;
+
+// How often the display RAM is read back and repaired while nobody is playing.
+constexpr uint_fast64_t repair_interval_us = 5000000;
+
+// How often the buttons are scanned, 4 equal scans in a row change the debounced state.
+constexpr uint32_t scan_frequency = 1000;
+
+// The buttons are scanned in the timer interrupt, both ports are read once and debounced together.
+// Every debounced change is queued for the main loop.
+button_input input;
+vertical_debounce debounce;
+due_port_scanner * scanner = nullptr;
+due_timer * scan_timer = nullptr;
+
+// The flush timer clocks out flush_bits bits every tick, about 27 us of every 100 us while a transfer runs.
+constexpr uint32_t flush_frequency = 10000;
+constexpr int flush_bits = 8;
+
+display * screen = nullptr;
+due_timer * flush_timer = nullptr;
+
+extern "C" void TC0_Handler(){
+	flush_timer->acknowledge();
+	screen->tick(flush_bits);
+}
+
+extern "C" void TC1_Handler(){
+	scan_timer->acknowledge();
+	if(debounce.update(scanner->read())){
+		input.sample(debounce.state(), due_stamp());
+	}
+}
+
+// The result screens are constexpr sprites, so they are stored in flash and take no RAM.
+// The comment above each sprite gives the position where it is drawn.
+
+// drawn at (1, 1)
+constexpr auto sprite_wins = make_sprite(
+	"..XXXXX",
+	".X.....",
+	"X......",
+	".XXX...",
+	"X......",
+	".X.....",
+	"..XXXXX",
+	".......",
+	"XXXXX.X",
+	"XXXXX.X",
+	".......",
+	"XXXXXXX",
+	".....X.",
+	"....X..",
+	"...X...",
+	"XXXXXXX",
+	".......",
+	".X.XXX.",
+	"X..X..X",
+	"X..X..X",
+	".XX..X."
+);
+
+// drawn at (9, 1)
+constexpr auto sprite_player = make_sprite(
+	"XXXXXX.",
+	"...X..X",
+	"...X..X",
+	"....XX."
+);
+
+// drawn at (10, 6)
+constexpr auto sprite_1 = make_sprite(
+	"....X.",
+	"X....X",
+	"XXXXXX",
+	"X....."
+);
+
+// drawn at (10, 6)
+constexpr auto sprite_2 = make_sprite(
+	"X.....",
+	"XX..X.",
+	"X.X..X",
+	"X..X.X",
+	"X...X."
+);
+
+// drawn at (4, 1)
+constexpr auto sprite_draw = make_sprite(
+	"XXXXXXXX",
+	"X......X",
+	"X......X",
+	".X....X.",
+	"..XXXX..",
+	"........",
+	"XXXXXX..",
+	".....X..",
+	"....XX..",
+	"...XX...",
+	"........",
+	"XXXXX...",
+	"...X.X..",
+	"...X..X.",
+	"...X.X..",
+	"XXXXX...",
+	"........",
+	".XXXXXX.",
+	"X.......",
+	".XXX....",
+	"X.......",
+	".XXXXXX."
+);
+
+// Draws the screen for a win of player 1.
+void draw_p1(display & ht){
+	ht.blit(sprite_wins, 1, 1);
+	ht.blit(sprite_player, 9, 1);
+	ht.blit(sprite_1, 10, 6);
+}
+
+// Draws the screen for a win of player 2.
+void draw_p2(display & ht){
+	ht.blit(sprite_wins, 1, 1);
+	ht.blit(sprite_player, 9, 1);
+	ht.blit(sprite_2, 10, 6);
+}
+
+// Draws the screen for a draw.
+void draw_draw(display & ht){
+	ht.blit(sprite_draw, 4, 1);
+}
 
 int main(void){
     // kill the watchdog
     WDT->WDT_MR = WDT_MR_WDDIS;
     namespace target = hwlib::target;
-    auto data = target::pin_in_out(target::pins::d8);
-    auto write = target::pin_in_out(target::pins::d9);
-    auto read = target::pin_in_out(target::pins::d10);
-    auto cs = target::pin_in_out(target::pins::d11);
-	auto sw_steen_p1 = target::pin_in_out(hwlib::target::pins::d7);
-	auto sw_papier_p1 = target::pin_in_out(hwlib::target::pins::d6);
-	auto sw_schaar_p1 = target::pin_in_out(hwlib::target::pins::d5);
-	auto sw_steen_p2 = target::pin_in_out(hwlib::target::pins::d4);
-	auto sw_papier_p2 = target::pin_in_out(hwlib::target::pins::d3);
-	auto sw_schaar_p2 = target::pin_in_out(hwlib::target::pins::d2);
-    auto setup = pin_setup(data, write, cs);
-	int steen_p1 = 0;
-	int papier_p1 = 0;
-	int schaar_p1 = 0;
-	int steen_p2 = 0;
-	int papier_p2 = 0;
-	int schaar_p2 = 0;
-	bool p1_keuze = 0;
-	bool p2_keuze = 0;
-    setup.direction_set_output();
-    setup.direction_flush();
+    auto data = direct_pin(target::pins::d8);
+    auto write = direct_pin(target::pins::d9);
+    auto read = direct_pin(target::pins::d10);
+    auto cs = direct_pin(target::pins::d11);
 	hwlib::wait_ms(2000);
-    bus bus(write, data, cs);
-	HT1632C ht(bus);
+    display_bus bus(write, data, cs, read);
+	display ht(bus);
 	ht.initialize();
 	hwlib::wait_ms(1);
 	ht.clear();
+	ht.flush();
 	ht.brightness(0xf);
-	sw_steen_p1.direction_set_input();
-	sw_papier_p1.direction_set_input();
-	sw_schaar_p1.direction_set_input();
-	sw_steen_p2.direction_set_input();
-	sw_papier_p2.direction_set_input();
-	sw_schaar_p2.direction_set_input();
+	// the handler uses both pointers, so the timer starts only once they are set
+	screen = &ht;
+	due_timer flush_tick(0, flush_frequency);
+	flush_timer = &flush_tick;
+	flush_tick.start();
+	
+	// every press is queued by the timer interrupt, also while the loop is flushing or showing a result
+	due_port_scanner switches({
+		{ target::pins::d7, BUTTON_STEEN_P1 },
+		{ target::pins::d6, BUTTON_PAPIER_P1 },
+		{ target::pins::d5, BUTTON_SCHAAR_P1 },
+		{ target::pins::d4, BUTTON_STEEN_P2 },
+		{ target::pins::d3, BUTTON_PAPIER_P2 },
+		{ target::pins::d2, BUTTON_SCHAAR_P2 }
+	});
+	scanner = &switches;
+	due_stamp_enable();
+	// the handler uses both pointers, so the timer starts only once they are set
+	due_timer timer(1, scan_frequency);
+	scan_timer = &timer;
+	timer.start();
+	
+	// the log is sent to the serial port a character at a time, only when the UART can take one
+	deferred_log logger;
+	due_uart_sink uart;
+	
+	game round;
+	uint_fast64_t next_repair = hwlib::now_us() + repair_interval_us;
+	
+#ifdef HT1632C_STATS
+	// a choice is timed from its debounced press until the transfer that shows it is complete
+	uint32_t choice_stamp = 0;
+	bool choice_waiting = false, choice_sending = false;
+	uint_fast64_t last_loop = hwlib::now_us();
+#endif
 	
 	while(true){
+#ifdef HT1632C_STATS
+		HT1632C_STATS_ADD(loop_iterations, 1);
+		HT1632C_STATS_VALUE(loop_us, uint32_t(hwlib::now_us() - last_loop));
+		last_loop = hwlib::now_us();
+#endif
 		
-	if(p1_keuze == 0){	
-		if(sw_steen_p1.read()){
-			if(steen_p1 == 0){
-				hwlib::cout << "Player 1 has chosen"<< "\n";
-				hwlib::wait_ms(10);
-				steen_p1 = 1;
-				p1_keuze = 1;
-			}
-		}
+		uint8_t buttons = input.buttons();
 		
-		if(sw_papier_p1.read()){
-			if(papier_p1 == 0){
-				hwlib::cout << "Player 1 has chosen" << "\n";
-				hwlib::wait_ms(10);
-				papier_p1 = 1;
-				p1_keuze = 1;
-			}
+		game_events events = round.update(hwlib::now_us(), buttons);
+		
+#ifdef HT1632C_STATS
+		if(events.p1_chosen || events.p2_chosen){
+			choice_stamp = input.pressed_at();
+			choice_waiting = true;
 		}
+#endif
 		
-		if(sw_schaar_p1.read()){
-			if(schaar_p1 == 0){
-				hwlib::cout << "Player 1 has chosen" << "\n";
-				hwlib::wait_ms(10);
-				schaar_p1 = 1;
-				p1_keuze = 1;
-			}
+		// a corner pixel acknowledges a choice, the next flush sends it as a single nibble
+		if(events.p1_chosen){
+			ht.setPixel(hwlib::xy(0, 0));
+			LOG_INFO(logger, "Player 1 has chosen");
 		}
-	}
-	
-	if( p2_keuze == 0 ){	
-		if(sw_steen_p2.read()){
-			if(steen_p2 == 0){
-				hwlib::cout << "Player 2 has chosen" << "\n";
-				hwlib::wait_ms(10);
-				steen_p2 = 1;
-				p2_keuze = 1;
-			}
+		if(events.p2_chosen){
+			ht.setPixel(hwlib::xy(15, 0));
+			LOG_INFO(logger, "Player 2 has chosen");
 		}
 		
-		if(sw_papier_p2.read()){
-			if(papier_p2 == 0){
-				hwlib::cout << "Player 2 has chosen" << "\n";
-				hwlib::wait_ms(10);
-				papier_p2 = 1;
-				p2_keuze = 1;
-			}
+		if(events.show == result::p1){
+			draw_p1(ht);
+		} else if(events.show == result::p2){
+			draw_p2(ht);
+		} else if(events.show == result::draw){
+			draw_draw(ht);
+		} else if(events.clear){
+			ht.clear();
+		}
+		
+		// starts sending what changed, while a transfer runs the changes wait for the next one
+#ifdef HT1632C_STATS
+		if(ht.flush_async() && choice_waiting){
+			choice_waiting = false;
+			choice_sending = true;
+		}
+		if(choice_sending && !ht.busy()){
+			HT1632C_STATS_VALUE(latency_us, (due_stamp() - choice_stamp) / 84);
+			choice_sending = false;
 		}
-				
-		if(sw_schaar_p2.read()){
-			if(schaar_p2 == 0){
-				hwlib::cout << "Player 2 has chosen" << "\n";
-				hwlib::wait_ms(10);
-				schaar_p2 = 1;
-				p2_keuze = 1; 
+#else
+		ht.flush_async();
+#endif
+		
+		// a brownout or a glitch can change the chip, the commands are sent again and only the wrong nibbles are repaired
+		if(round.status() == game::state::waiting && hwlib::now_us() >= next_repair){
+			while(ht.busy()){}
+			ht.initialize();
+			int wrong = ht.repair();
+			if(wrong){
+				LOG_WARN(logger, "Display repaired, wrong nibbles:", wrong);
 			}
+			next_repair = hwlib::now_us() + repair_interval_us;
 		}
-	}
-	
-	if( (steen_p1 == 1 && schaar_p2 == 1) || (papier_p1 == 1 && steen_p2 == 1) || (schaar_p1 == 1 && papier_p2 == 1) ||
-      (steen_p2 == 1 && schaar_p1 == 1) || (papier_p2 == 1 && steen_p1 == 1) || (schaar_p2 == 1 && papier_p1 == 1) ){
-		hwlib::xy xy0(6, 1); hwlib::xy xy1(5, 1); hwlib::xy xy2(4, 1); hwlib::xy xy3(3,1 ); hwlib::xy xy4(2, 2); hwlib::xy xy5(1, 3); hwlib::xy xy6(2, 4);
-		hwlib::xy xy7(3, 4); hwlib::xy xy8(1, 5); hwlib::xy xy9(2, 6); hwlib::xy xy10(3, 7); hwlib::xy xy11(4, 7); hwlib::xy xy12(5,7); hwlib::xy xy13(6,7);
-		ht.setPixel(xy0); ht.setPixel(xy1); ht.setPixel(xy2); ht.setPixel(xy3); ht.setPixel(xy4); ht.setPixel(xy5); ht.setPixel(xy6); ht.setPixel(xy7);
-		ht.setPixel(xy8); ht.setPixel(xy9); ht.setPixel(xy10); ht.setPixel(xy11); ht.setPixel(xy12); ht.setPixel(xy13);
 		
-	for(int x=1; x < 6; x++){
-		hwlib::xy xy14(x, 9); hwlib::xy xy15(x, 10);
-		ht.setPixel(xy14); ht.setPixel(xy15);
-	}
-	
-	hwlib::xy xy35(7, 9); hwlib::xy xy36(7, 10);
-	ht.setPixel(xy35); ht.setPixel(xy36);
-	
-	for(int x = 1; x < 8; x++){
-		hwlib::xy xy16(x, 12); hwlib::xy xy17(x, 16);
-		ht.setPixel(xy16); ht.setPixel(xy17);
-	}
-	
-	hwlib::xy xy18(6, 13); hwlib::xy xy19(5, 14); hwlib::xy xy20(4,15); hwlib::xy xy21(3, 16); 
-	ht.setPixel(xy18); ht.setPixel(xy19); ht.setPixel(xy20); ht.setPixel(xy21);
-	hwlib::xy xy22(1, 19); hwlib::xy xy23(1, 20); hwlib::xy xy24(2, 18); hwlib::xy xy25(2, 21); hwlib::xy xy26(3, 21); hwlib::xy xy27(4, 18); 
-	hwlib::xy xy28(4, 19); hwlib::xy xy29(4,20); hwlib::xy xy30(5, 18); hwlib::xy xy31(6, 18); hwlib::xy xy32(7, 19); hwlib::xy xy33(7, 20);
-	hwlib::xy xy34(6, 21); hwlib::xy xy37(7, 1); hwlib::xy xy38(7, 7); hwlib::xy xy39(4, 4);
-	ht.setPixel(xy22); ht.setPixel(xy23); ht.setPixel(xy24); ht.setPixel(xy25); ht.setPixel(xy26); ht.setPixel(xy27); ht.setPixel(xy28); ht.setPixel(xy29); ht.setPixel(xy30);
-	ht.setPixel(xy31); ht.setPixel(xy32); ht.setPixel(xy33); ht.setPixel(xy34); ht.setPixel(xy37); ht.setPixel(xy38); ht.setPixel(xy39);
-	
-	for(int x=9; x < 15; x++){
-		hwlib::xy xy40(x, 1);
-		ht.setPixel(xy40);
-	}
-	
-	// P 
-	hwlib::xy xy41(12, 2); hwlib::xy xy42(12, 3); hwlib::xy xy43(13, 4); hwlib::xy xy44(14,4); hwlib::xy xy45(15, 2); hwlib::xy xy46(15,3);
-	ht.setPixel(xy41); ht.setPixel(xy42); ht.setPixel(xy43); ht.setPixel(xy44); ht.setPixel(xy45); ht.setPixel(xy46);
-	
-	if( (steen_p1 == 1 && schaar_p2 == 1) || (papier_p1 == 1 && steen_p2 == 1) || (schaar_p1 == 1 && papier_p2 == 1) ){
-	// 1
-	hwlib::xy xy47(14, 6); hwlib::xy xy48(15,7); hwlib::xy xy49(10, 7); hwlib::xy xy50(10, 9); 
-	ht.setPixel(xy47); ht.setPixel(xy48); ht.setPixel(xy49); ht.setPixel(xy50);
-	
-	for(int x = 10; x < 16; x++){
-		hwlib::xy xy51(x, 8);
-		ht.setPixel(xy51);
-	}
-	
-	ht.flush();
-	hwlib::wait_ms(2000);
-	p1_keuze = 0; p2_keuze = 0; steen_p1 = 0; steen_p2 = 0; papier_p1 = 0; papier_p2 = 0; schaar_p1 = 0; schaar_p2 = 0;
-	ht.clear();
-	}
-	
-	else{
-		// 2
-		hwlib::xy xy51(14, 7); hwlib::xy xy52(15,8); hwlib::xy xy53(15, 9); hwlib::xy xy54(15, 9); hwlib::xy xy55(14, 10); hwlib::xy xy56(13, 9);
-		hwlib::xy xy57(12, 8); hwlib::xy xy58(11, 7);
-		ht.setPixel(xy51); ht.setPixel(xy52); ht.setPixel(xy53); ht.setPixel(xy54); ht.setPixel(xy55); ht.setPixel(xy56); ht.setPixel(xy57); ht.setPixel(xy58);
+		logger.drain(uart);
 		
-	for(int y = 6; y <= 10; y++){
-		hwlib::xy xy59(10, y);
-		ht.setPixel(xy59);
-	}
-	
-	ht.flush();
-	hwlib::wait_ms(2000);
-	p1_keuze = 0; p2_keuze = 0; steen_p1 = 0; steen_p2 = 0; papier_p1 = 0; papier_p2 = 0; schaar_p1 = 0; schaar_p2 = 0;
-	ht.clear();
-	}
-}
-
-else if( ( steen_p1 == 1 && steen_p2 == 1) || ( papier_p1 == 1 && papier_p2 == 1) || (schaar_p1 == 1 && schaar_p2 == 1) ){
-	// D
-	for(int x = 4; x < 12; x++){
-		hwlib::xy xy60(x, 1);
-		ht.setPixel(xy60);
-	}
-	
-	hwlib::xy xy61(11, 2); hwlib::xy xy62(11, 3); hwlib::xy xy63(10, 4); hwlib::xy xy64(9, 5); hwlib::xy xy65(8,5); hwlib::xy xy66(7,5); hwlib::xy xy67(6, 5);
-	hwlib::xy xy68(5, 4); hwlib::xy xy69(4,3); hwlib::xy xy70(4,2);
-	ht.setPixel(xy61); ht.setPixel(xy62); ht.setPixel(xy63); ht.setPixel(xy64); ht.setPixel(xy65); ht.setPixel(xy66); ht.setPixel(xy67); ht.setPixel(xy68); 
-	ht.setPixel(xy69); ht.setPixel(xy70); 
-	// R
-	
-	for(int x = 4; x < 10; x++){
-		hwlib::xy xy71(x, 7);
-		ht.setPixel(xy71);
-	}
-	
-	hwlib::xy xy72(9, 8); hwlib::xy xy73(9,9); hwlib::xy xy74(8,9); hwlib::xy xy75(8,10); hwlib::xy xy76(7, 10);
-	ht.setPixel(xy72); ht.setPixel(xy73); ht.setPixel(xy74); ht.setPixel(xy75); ht.setPixel(xy76);
-	
-	// A 
-	for(int x = 4; x < 9; x++){
-		hwlib::xy xy77(x, 12); hwlib::xy xy78(x, 16);
-		ht.setPixel(xy77); ht.setPixel(xy78);
-	}
-	
-	hwlib::xy xy79(9, 13); hwlib::xy xy80(10, 14); hwlib::xy xy81(9, 15); hwlib::xy xy82(7, 13); hwlib::xy xy83(7, 14); hwlib::xy xy84(7, 15); 
-	ht.setPixel(xy79); ht.setPixel(xy80); ht.setPixel(xy81); ht.setPixel(xy82); ht.setPixel(xy83); ht.setPixel(xy84);
-	
-	// W
-	for(int x = 5; x < 11; x++){
-		hwlib::xy xy85(x, 18); hwlib::xy xy86(x, 22);
-		ht.setPixel(xy85); ht.setPixel(xy86);
+#ifdef HT1632C_STATS
+		if((UART->UART_SR & UART_SR_RXRDY) && UART->UART_RHR == 's'){
+			ht1632c_stats.dump(hwlib::cout);
+		}
+#endif
 	}
-	
-	hwlib::xy xy87(4, 19); hwlib::xy xy88(4, 21); hwlib::xy xy89(5, 20); hwlib::xy xy90(6, 20); hwlib::xy xy91(7, 20);
-	ht.setPixel(xy87); ht.setPixel(xy88); ht.setPixel(xy89); ht.setPixel(xy90); ht.setPixel(xy91);
-	ht.flush();
-	hwlib::wait_ms(2000);
-	p1_keuze = 0; p2_keuze = 0; steen_p1 = 0; steen_p2 = 0; papier_p1 = 0; papier_p2 = 0; schaar_p1 = 0; schaar_p2 = 0;
-	ht.clear();
-}
-
-else{
-	ht.clear();
 }
-	}
-	}
-	
-
-
@@ -0,0 +1,344 @@
+#ifndef HT1632C_SIM_HPP
+#define HT1632C_SIM_HPP
+#include "hwlib.hpp"
+#include "Matrix.hpp"
+
+/// @file
+
+/// \brief
+/// HT1632C chip simulator
+/// \details
+/// A model of the HT1632C that runs on the host.
+/// The wr, data, cs and rd members are mock pins that can be handed to a bus.
+/// Every level change on those pins is fed into a state machine that decodes the serial protocol:
+/// - the 3 bit ID selects command, write or read mode.
+/// - in command mode every 9 bits are one command (8 bits and a don't care bit), any number of commands can follow the ID.
+/// - in write mode a 7 bit address follows, then any number of 4 bit nibbles with successive addresses.
+///   Addresses past the RAM of the COM mode wrap around, the first one as well.
+/// - in read mode a 7 bit address follows, then the chip drives DATA on every falling RD edge.
+///
+/// The display RAM is stored one nibble per byte, in the order the bits are clocked in,
+/// so the first bit of a nibble (D0) ends up in bit 3.
+/// Besides the RAM the simulator keeps the command state and counts edges, bits, transactions and commands.
+/// Faults can be injected to test the read back: single nibbles can be corrupted,
+/// written nibbles can be glitched and a brownout scrambles the RAM and resets the command state.
+/// When the chip drives DATA while the data pin is still an output, that is counted as contention.
+class ht1632c_sim{
+public:
+	/// \brief
+	/// state of the serial decoder
+	enum class mode { idle, id, command, write_address, write_data, read_address, read_data, invalid };
+
+	/// \brief
+	/// Mock pin connected to the simulator
+	class line : public hwlib::pin_in_out{
+	protected:
+		ht1632c_sim & chip;
+		bool level = true;
+		bool output = true;
+		friend class ht1632c_sim;
+	public:
+		line(ht1632c_sim & chip):
+			chip( chip )
+		{}
+		
+		void write(bool v) override{
+			if(v != level){
+				level = v;
+				chip.edge(*this);
+			}
+		}
+		
+		bool read() override{
+			return level;
+		}
+		
+		void direction_set_input() override{ output = false; chip.direction_changes++; }
+		void direction_set_output() override{ output = true; chip.direction_changes++; }
+		void direction_flush() override{}
+		void refresh() override{}
+		void flush() override{}
+	};
+	
+	line wr, data, cs, rd;
+	
+	uint8_t ram[96] = {0};
+	bool sysen = false;
+	bool ledon = false;
+	bool blink = false;
+	uint8_t clock_mode = 0;
+	uint8_t com_mode = HT1632C_CMD_COMS00;
+	uint8_t pwm = 0xf;
+	
+	uint32_t edges = 0;
+	uint32_t bits = 0;
+	uint32_t transactions = 0;
+	uint32_t commands = 0;
+	uint32_t nibbles_written = 0;
+	uint32_t nibbles_read = 0;
+	uint32_t direction_changes = 0;
+	uint32_t contention = 0;
+	
+	ht1632c_sim():
+		wr( *this ), data( *this ), cs( *this ), rd( *this )
+	{}
+	
+	/// \brief
+	/// number of nibbles in the RAM for the current COM mode
+	int ram_size() const {
+		return is_16_com() ? 96 : 64;
+	}
+	
+	/// \brief
+	/// true when one of the 16 COM options is selected
+	bool is_16_com() const {
+		return com_mode & 0x04;
+	}
+	
+	/// \brief
+	/// state of the LED at a ROW and COM line
+	bool led(int row, int com) const {
+		return ram[ht1632c_address(row, com, is_16_com() ? 16 : 8)] & ht1632c_bit(com);
+	}
+	
+	/// \brief
+	/// resets the counters
+	void reset_counters(){
+		edges = bits = transactions = commands = nibbles_written = nibbles_read = direction_changes = contention = 0;
+	}
+	
+	/// \brief
+	/// overwrites a nibble of the RAM, like a disturbance on the chip would
+	void corrupt(int address, uint8_t value){
+		ram[address] = value & 0xf;
+	}
+	
+	/// \brief
+	/// XORs the next n nibbles that are written with pattern, like glitches on the bus would
+	void glitch(int n, uint8_t pattern = 0xf){
+		glitches = n;
+		glitch_pattern = pattern & 0xf;
+	}
+	
+	/// \brief
+	/// simulates a brownout
+	/// \details
+	/// The RAM gets random content and the command state goes back to its power on reset values.
+	void brownout(uint32_t seed = 1){
+		for(auto & n : ram){
+			seed = seed * 1103515245 + 12345;
+			n = (seed >> 16) & 0xf;
+		}
+		sysen = false;
+		ledon = false;
+		blink = false;
+		clock_mode = 0;
+		com_mode = HT1632C_CMD_COMS00;
+		pwm = 0xf;
+	}
+	
+	/// \brief
+	/// current state of the serial decoder
+	mode state() const {
+		return current;
+	}
+	
+protected:
+	mode current = mode::idle;
+	uint16_t shift = 0;
+	int count = 0;
+	int address = 0;
+	int glitches = 0;
+	uint8_t glitch_pattern = 0;
+	
+	void edge(line & l){
+		edges++;
+		if(&l == &cs){
+			if(!cs.level){
+				current = mode::id;
+				shift = 0;
+				count = 0;
+			} else {
+				if(current != mode::idle){
+					transactions++;
+				}
+				current = mode::idle;
+			}
+		} else if(&l == &wr){
+			if(wr.level && !cs.level){
+				clock_in(data.level);
+			}
+		} else if(&l == &rd){
+			if(!rd.level && !cs.level && current == mode::read_data){
+				clock_out();
+			}
+		}
+	}
+	
+	void clock_in(bool bit){
+		bits++;
+		shift = (shift << 1) | bit;
+		count++;
+		switch(current){
+			case mode::id:
+				if(count == HT1632C_ID_LEN){
+					current = shift == HT1632C_ID_COMMAND ? mode::command
+						: shift == HT1632C_ID_WRITE ? mode::write_address
+						: shift == HT1632C_ID_READ ? mode::read_address
+						: mode::invalid;
+					shift = 0;
+					count = 0;
+				}
+				break;
+			case mode::command:
+				if(count == HT1632C_CMD_LEN + 1){
+					command(shift >> 1);
+					shift = 0;
+					count = 0;
+				}
+				break;
+			case mode::write_address:
+			case mode::read_address:
+				if(count == HT1632C_ADDRESS_LEN){
+					address = shift % ram_size();
+					current = current == mode::write_address ? mode::write_data : mode::read_data;
+					shift = 0;
+					count = 0;
+				}
+				break;
+			case mode::write_data:
+				if(count == HT1632C_DATA_LEN){
+					ram[address] = shift & 0xf;
+					if(glitches){
+						ram[address] ^= glitch_pattern;
+						glitches--;
+					}
+					nibbles_written++;
+					address = (address + 1) % ram_size();
+					shift = 0;
+					count = 0;
+				}
+				break;
+			default:
+				break;
+		}
+	}
+	
+	void clock_out(){
+		if(data.output){
+			contention++;
+		}
+		data.level = ram[address] & (0x8 >> count);
+		count++;
+		if(count == HT1632C_DATA_LEN){
+			nibbles_read++;
+			address = (address + 1) % ram_size();
+			count = 0;
+		}
+	}
+	
+	void command(uint8_t c){
+		commands++;
+		if(c == HT1632C_CMD_SYSDIS){
+			sysen = false;
+			ledon = false;
+		} else if(c == HT1632C_CMD_SYSEN){
+			sysen = true;
+		} else if(c == HT1632C_CMD_LEDOFF){
+			ledon = false;
+		} else if(c == HT1632C_CMD_LEDON){
+			ledon = true;
+		} else if(c == HT1632C_CMD_BLINKOFF){
+			blink = false;
+		} else if(c == HT1632C_CMD_BLINKON){
+			blink = true;
+		} else if((c & 0xf0) == 0x10){
+			clock_mode = c & 0x1c;
+		} else if((c & 0xf0) == 0x20){
+			com_mode = c & 0x2c;
+		} else if((c & 0xf0) == HT1632C_CMD_PWMCONTROL){
+			pwm = c & 0x0f;
+		}
+	}
+};
+
+/// \brief
+/// pin shared by several simulators
+/// \details
+/// Chained panels have their WR and DATA pins connected together, only CS is separate.
+/// A write goes to the same pin of every added simulator, a read comes from the first one.
+class sim_shared_line : public hwlib::pin_in_out{
+protected:
+	ht1632c_sim::line * lines[32];
+	int n = 0;
+public:
+	void add(ht1632c_sim::line & l){
+		lines[n++] = &l;
+	}
+	
+	void write(bool v) override{
+		for(int i = 0; i < n; i++){
+			lines[i]->write(v);
+		}
+	}
+	
+	bool read() override{
+		return lines[0]->read();
+	}
+	
+	void direction_set_input() override{
+		for(int i = 0; i < n; i++){
+			lines[i]->direction_set_input();
+		}
+	}
+	
+	void direction_set_output() override{
+		for(int i = 0; i < n; i++){
+			lines[i]->direction_set_output();
+		}
+	}
+	
+	void direction_flush() override{}
+	void refresh() override{}
+	void flush() override{}
+};
+
+/// \brief
+/// port with the DATA lines of several simulators
+/// \details
+/// Bit k of a write goes to the DATA pin of simulator k, like the lanes of a direct_port.
+class sim_port{
+protected:
+	ht1632c_sim::line * lanes[8];
+	int n = 0;
+public:
+	void add(ht1632c_sim::line & l){
+		lanes[n++] = &l;
+	}
+	
+	void set_output(){
+		for(int i = 0; i < n; i++){
+			lanes[i]->direction_set_output();
+		}
+	}
+	
+	void write(uint32_t v){
+		for(int i = 0; i < n; i++){
+			lanes[i]->write((v >> i) & 1);
+		}
+	}
+};
+
+/// \brief
+/// bus on the pins of a simulator
+/// \details
+/// The pin type is the concrete simulator pin, so the bus makes no virtual calls.
+template< typename Timing = timing_none >
+using sim_bus = basic_bus< ht1632c_sim::line, ht1632c_sim::line, ht1632c_sim::line, Timing >;
+
+/// \brief
+/// HT1632C driver on the pins of a simulator
+template< typename Timing = timing_none >
+using sim_HT1632C = basic_HT1632C< sim_bus< Timing > >;
+
+#endif
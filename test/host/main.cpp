@@ -0,0 +1,2192 @@
+// the counters of Stats.hpp are compiled in and checked against the simulator
+#define HT1632C_STATS
+#include "hwlib.hpp"
+#include "Matrix.hpp"
+#include "mock_pin.hpp"
+#include "ht1632c_sim.hpp"
+#include "Game.hpp"
+#include "PanelArray.hpp"
+#include "SlicedPanels.hpp"
+#include "MatrixWindow.hpp"
+#include "Buttons.hpp"
+#include "AsyncFlush.hpp"
+#include "Log.hpp"
+#include "Stats.hpp"
+#include "Trace.hpp"
+#include "Grayscale.hpp"
+#include <utility>
+#include <string>
+#include <sstream>
+#include <thread>
+#include <atomic>
+#include <cstdlib>
+#include <cstring>
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#endif
+
+// ids of the mock pins in the edge log
+enum { PIN_WR, PIN_DATA, PIN_CS };
+
+// Flushes a number of frames through a bus with the given timing profile.
+// The frame time runs from CS going low to CS going high, the bits are the rising WR edges in between.
+template< typename Timing >
+void bench_timing(const char * name){
+	const int frames = 20;
+	std::vector< pin_edge > log;
+	log.reserve(frames * 1000);
+	mock_pin write(log, PIN_WR);
+	mock_pin data(log, PIN_DATA);
+	mock_pin cs(log, PIN_CS);
+	basic_bus< mock_pin, mock_pin, mock_pin, Timing > bus(write, data, cs);
+	basic_HT1632C< basic_bus< mock_pin, mock_pin, mock_pin, Timing > > ht(bus);
+	ht.flush();
+	log.clear();
+	
+	for(int i = 0; i < frames; i++){
+		ht.flush_all();
+	}
+	
+	uint64_t start = 0, total_ns = 0, bits = 0;
+	for(const auto & e : log){
+		if(e.pin == PIN_CS){
+			if(!e.level){
+				start = e.time_ns;
+			} else {
+				total_ns += e.time_ns - start;
+			}
+		} else if(e.pin == PIN_WR && e.level){
+			bits++;
+		}
+	}
+	
+	hwlib::cout << name << ": " << bits / frames << " bits per frame, "
+		<< total_ns / frames / 1000 << " us per frame, "
+		<< bits * 1000000000ULL / total_ns << " bits/s" << "\n";
+}
+
+// Checks that the simulated LEDs show exactly the pixels in the given buffer.
+bool leds_match(const ht1632c_sim & sim, const uint16_t rows[HT1632C_LENGTH]){
+	for(int y = 0; y < HT1632C_LENGTH; y++){
+		for(int x = 0; x < HT1632C_WIDTH; x++){
+			if(sim.led(y, x) != bool(rows[y] & (0x8000 >> x))){
+				return false;
+			}
+		}
+	}
+	return true;
+}
+
+// Runs the initialization and brightness commands and checks the command state of the simulator,
+// then draws a pattern and checks the simulated LEDs.
+void test_simulator(){
+	ht1632c_sim sim;
+	sim_bus<> bus(sim.wr, sim.data, sim.cs);
+	sim_HT1632C<> ht(bus);
+	ht.initialize();
+	ht.brightness(0x7);
+	if(!sim.sysen || !sim.ledon || sim.blink || sim.clock_mode != HT1632C_CMD_INT_RC
+		|| sim.com_mode != HT1632C_CMD_COMS01 || sim.pwm != 0x7 || sim.commands != 6){
+		hwlib::cout << "command state does not match initialize() and brightness()" << "\n";
+		exit(1);
+	}
+	
+	uint16_t rows[HT1632C_LENGTH] = {0};
+	ht.clear();
+	for(int i = 0; i < HT1632C_LENGTH; i++){
+		hwlib::xy xy((i * 7) % HT1632C_WIDTH, i);
+		ht.setPixel(xy);
+		rows[i] |= 0x8000 >> xy.x;
+	}
+	sim.reset_counters();
+	ht.flush();
+	if(!leds_match(sim, rows)){
+		hwlib::cout << "simulated LEDs do not match the drawn pixels" << "\n";
+		exit(1);
+	}
+	if(sim.direction_changes != 0){
+		hwlib::cout << "flush changed the direction of the pins" << "\n";
+		exit(1);
+	}
+	hwlib::cout << "flush: " << sim.transactions << " transactions, " << sim.bits << " bits, "
+		<< sim.nibbles_written << " nibbles, " << sim.edges << " edges" << "\n";
+	
+	// a run that starts at an address past the RAM wraps around, in the 16 and in the 8 COM mode
+	ht1632c_sim high;
+	sim_bus<> high_bus(high.wr, high.data, high.cs, high.rd);
+	sim_HT1632C<> chip(high_bus);
+	for(uint8_t com : { HT1632C_CMD_COMS01, HT1632C_CMD_COMS00 }){
+		chip.cmnd(com);
+		for(int address : { 95, 100, 127 }){
+			{
+				basic_writeTransaction< sim_bus<> > write(high_bus);
+				write.writeData(HT1632C_ID_LEN, HT1632C_ID_WRITE);
+				write.writeData(HT1632C_ADDRESS_LEN, address);
+				write.writeData(HT1632C_DATA_LEN, 0xA);
+				write.writeData(HT1632C_DATA_LEN, 0x5);
+			}
+			int first = address % high.ram_size();
+			uint8_t back[2];
+			chip.readRam(address, 2, back);
+			if(high.ram[first] != 0xA || high.ram[(first + 1) % high.ram_size()] != 0x5 || back[0] != 0xA || back[1] != 0x5){
+				hwlib::cout << "a run at address " << address << " does not wrap around the RAM" << "\n";
+				exit(1);
+			}
+		}
+	}
+	hwlib::cout << "passed" << "\n";
+}
+
+// Draws random pixels in a few rows per frame and checks that the partial flushes leave the same RAM
+// in the simulator as full flushes of the same buffer.
+void test_dirty_flush(){
+	ht1632c_sim sim, full_sim;
+	sim_bus<> bus(sim.wr, sim.data, sim.cs), full_bus(full_sim.wr, full_sim.data, full_sim.cs);
+	sim_HT1632C<> ht(bus), full(full_bus);
+	ht.initialize();
+	full.initialize();
+	uint32_t partial_bits = 0, full_bits = 0;
+	srand(1);
+	
+	for(int frame = 0; frame < 50; frame++){
+		if(frame % 10 == 0){
+			ht.clear();
+			full.clear();
+		}
+		for(int i = 0; i < 3; i++){
+			hwlib::xy xy(rand() % HT1632C_WIDTH, rand() % HT1632C_LENGTH);
+			ht.setPixel(xy);
+			full.setPixel(xy);
+		}
+		sim.reset_counters();
+		full_sim.reset_counters();
+		ht.flush();
+		full.flush_all();
+		partial_bits += sim.bits;
+		full_bits += full_sim.bits;
+		if(memcmp(sim.ram, full_sim.ram, sizeof(sim.ram)) != 0){
+			hwlib::cout << "frame " << frame << ": RAM differs from a full flush" << "\n";
+			exit(1);
+		}
+	}
+	
+	sim.reset_counters();
+	ht.flush();
+	if(sim.edges != 0){
+		hwlib::cout << "flush without changes caused bus traffic" << "\n";
+		exit(1);
+	}
+	
+	hwlib::cout << "partial flushes: " << partial_bits << " bits, full flushes: " << full_bits << " bits" << "\n";
+	hwlib::cout << "passed" << "\n";
+}
+
+// Plays every combination of choices with a simulated clock and checks the result, the result hold and the cooldown.
+// Then presses random buttons at random times while the loop runs with a fixed iteration time,
+// and reports the worst time between a press and the iteration that acknowledges it.
+void test_game(){
+	const uint8_t p1_buttons[] = { BUTTON_STEEN_P1, BUTTON_PAPIER_P1, BUTTON_SCHAAR_P1 };
+	const uint8_t p2_buttons[] = { BUTTON_STEEN_P2, BUTTON_PAPIER_P2, BUTTON_SCHAAR_P2 };
+	const result expected[3][3] = {
+		{ result::draw, result::p2, result::p1 },
+		{ result::p1, result::draw, result::p2 },
+		{ result::p2, result::p1, result::draw }
+	};
+	uint_fast64_t now = 0;
+	game round;
+	for(int i = 0; i < 3; i++){
+		for(int j = 0; j < 3; j++){
+			game_events events = round.update(now, p1_buttons[i]);
+			if(!events.p1_chosen || events.p2_chosen || events.show != result::none){
+				hwlib::cout << "player 1 press not acknowledged" << "\n";
+				exit(1);
+			}
+			events = round.update(now += 100, p2_buttons[j] | p1_buttons[(i + 1) % 3]);
+			if(events.p1_chosen || !events.p2_chosen || events.show != expected[i][j]){
+				hwlib::cout << "wrong result for " << i << " against " << j << "\n";
+				exit(1);
+			}
+			events = round.update(now += 1999999, BUTTONS_P1 | BUTTONS_P2);
+			if(events.clear || events.p1_chosen || events.p2_chosen || round.status() != game::state::showing_result){
+				hwlib::cout << "result not held for 2 seconds" << "\n";
+				exit(1);
+			}
+			events = round.update(now += 1, BUTTONS_P1);
+			if(!events.clear || round.status() != game::state::cooldown){
+				hwlib::cout << "display not cleared after the result" << "\n";
+				exit(1);
+			}
+			round.update(now += 20000, BUTTONS_P1);
+			if(round.status() != game::state::cooldown){
+				hwlib::cout << "held button ended the cooldown" << "\n";
+				exit(1);
+			}
+			round.update(now += 100, 0);
+			if(round.status() != game::state::waiting){
+				hwlib::cout << "cooldown did not end" << "\n";
+				exit(1);
+			}
+		}
+	}
+	
+	const uint_fast64_t iteration_us = 50;
+	uint_fast64_t press_at[2] = { 0, 0 }, worst = 0;
+	int rounds = 0;
+	srand(2);
+	now = 0;
+	round = game();
+	while(rounds < 100){
+		uint8_t buttons = 0;
+		for(int p = 0; p < 2; p++){
+			if(press_at[p] == 0 && round.status() == game::state::waiting){
+				press_at[p] = now + rand() % 5000;
+			}
+			if(press_at[p] != 0 && now >= press_at[p]){
+				buttons |= (p == 0 ? p1_buttons : p2_buttons)[rand() % 3];
+			}
+		}
+		game_events events = round.update(now, buttons);
+		for(int p = 0; p < 2; p++){
+			if(p == 0 ? events.p1_chosen : events.p2_chosen){
+				if(now - press_at[p] > worst){
+					worst = now - press_at[p];
+				}
+			}
+		}
+		if(events.clear){
+			press_at[0] = press_at[1] = 0;
+			rounds++;
+		}
+		now += iteration_us;
+	}
+	hwlib::cout << "worst press to acknowledge latency: " << worst << " us with a " << iteration_us << " us loop" << "\n";
+	if(worst > iteration_us){
+		hwlib::cout << "press acknowledged later than the next iteration" << "\n";
+		exit(1);
+	}
+	hwlib::cout << "passed" << "\n";
+}
+
+// Runs the idle main loop with the datasheet timing: sample the buttons, update the game and refresh the display.
+// Before, the idle path called a clear that sent a full frame every iteration.
+// Now clear only changes the buffer and the flush sends nothing while the display content stays the same.
+template< bool full_clear >
+uint64_t polling_rate(int iterations){
+	ht1632c_sim sim;
+	sim_bus< timing_datasheet > bus(sim.wr, sim.data, sim.cs);
+	sim_HT1632C< timing_datasheet > ht(bus);
+	hwlib::pin_in_out * buttons[6] = { &sim.rd, &sim.rd, &sim.rd, &sim.rd, &sim.rd, &sim.rd };
+	game round;
+	ht.initialize();
+	ht.flush();
+	uint64_t start = host_now_ns();
+	for(int i = 0; i < iterations; i++){
+		uint8_t pressed = 0;
+		for(int b = 0; b < 6; b++){
+			if(!buttons[b]->read()) pressed |= 1 << b;
+		}
+		round.update(hwlib::now_us(), pressed);
+		ht.clear();
+		if(full_clear){
+			ht.flush_all();
+		} else {
+			ht.flush();
+		}
+	}
+	return iterations * 1000000000ULL / (host_now_ns() - start);
+}
+
+void bench_polling(){
+	hwlib::cout << "idle loop with a full frame clear: " << polling_rate< true >(200) << " iterations/s" << "\n";
+	hwlib::cout << "idle loop with a buffered clear: " << polling_rate< false >(200000) << " iterations/s" << "\n";
+}
+
+// Blits a sprite in every mode, also partly outside the display, and checks the simulated LEDs.
+void test_blit(){
+	static constexpr auto block = make_sprite(
+		"XXX",
+		"X.X",
+		"XXX"
+	);
+	static_assert(block.width == 3 && block.rows[1] == 0xA000, "sprite not built at compile time");
+	ht1632c_sim sim;
+	sim_bus<> bus(sim.wr, sim.data, sim.cs);
+	sim_HT1632C<> ht(bus);
+	uint16_t rows[HT1632C_LENGTH] = {0};
+	ht.initialize();
+	
+	ht.blit(block, -1, -1);
+	rows[0] |= 0x4000; rows[1] |= 0xC000;
+	ht.blit(block, 14, 22);
+	rows[22] |= 0x0003; rows[23] |= 0x0002;
+	ht.blit(block, 4, 4);
+	rows[4] |= 0x0E00; rows[5] |= 0x0A00; rows[6] |= 0x0E00;
+	ht.flush();
+	if(!leds_match(sim, rows)){
+		hwlib::cout << "set blit or clipping wrong" << "\n";
+		exit(1);
+	}
+	
+	ht.blit(block, 5, 4, blit_mode::toggle);
+	rows[4] ^= 0x0700; rows[5] ^= 0x0500; rows[6] ^= 0x0700;
+	ht.blit(block, 0, 0, blit_mode::replace);
+	rows[0] = (rows[0] & 0x1FFF) | 0xE000; rows[1] = (rows[1] & 0x1FFF) | 0xA000; rows[2] = (rows[2] & 0x1FFF) | 0xE000;
+	sim.reset_counters();
+	ht.flush();
+	if(!leds_match(sim, rows)){
+		hwlib::cout << "toggle or replace blit wrong" << "\n";
+		exit(1);
+	}
+	
+	sim.reset_counters();
+	ht.blit(block, 4, 4, blit_mode::set);
+	ht.blit(block, 16, 0);
+	ht.blit(block, 0, 24);
+	ht.flush();
+	if(sim.bits != (HT1632C_RUN_OVERHEAD + HT1632C_DATA_LEN) * 2){
+		hwlib::cout << "blit marked unchanged rows dirty" << "\n";
+		exit(1);
+	}
+	hwlib::cout << "passed" << "\n";
+}
+
+// Draws two frames that share most rows, each time clearing and redrawing the whole back buffer,
+// and checks that a swap only sends the rows that differ from what the display shows.
+void test_swap(){
+	static constexpr auto frame = make_sprite(
+		"XXXXXXXXXXXXXXXX",
+		"X..............X",
+		"X..............X",
+		"XXXXXXXXXXXXXXXX"
+	);
+	static constexpr auto one = make_sprite( ".X", "XX", ".X" );
+	static constexpr auto two = make_sprite( "XX", "X.", ".X" );
+	ht1632c_sim sim;
+	sim_bus<> bus(sim.wr, sim.data, sim.cs);
+	sim_HT1632C<> ht(bus);
+	ht.initialize();
+	
+	ht.blit(frame, 0, 10);
+	ht.blit(one, 7, 20);
+	ht.swap();
+	
+	sim.reset_counters();
+	ht.clear();
+	ht.blit(frame, 0, 10);
+	ht.blit(two, 7, 20);
+	ht.swap();
+	if(sim.transactions != 2 || sim.nibbles_written != 2){
+		hwlib::cout << "swap sent rows that did not change: " << sim.nibbles_written << " nibbles" << "\n";
+		exit(1);
+	}
+	
+	sim.reset_counters();
+	ht.clear();
+	ht.blit(frame, 0, 10);
+	ht.blit(two, 7, 20);
+	ht.swap();
+	if(sim.edges != 0){
+		hwlib::cout << "redrawing the same frame caused bus traffic" << "\n";
+		exit(1);
+	}
+	
+	sim.reset_counters();
+	ht.flush_all();
+	if(sim.nibbles_written != 96){
+		hwlib::cout << "flush_all did not send the whole frame" << "\n";
+		exit(1);
+	}
+	hwlib::cout << "passed" << "\n";
+}
+
+// Checks that initialize() and a runtime batch each use one transaction,
+// and compares the bits with sending the same commands one by one.
+void test_commands(){
+	static constexpr auto wake = make_commands( HT1632C_CMD_SYSEN, HT1632C_CMD_LEDON );
+	static_assert(wake.bits == 21 && wake.words[0] == 0x80203000, "command sequence packed wrong");
+	ht1632c_sim sim;
+	sim_bus<> bus(sim.wr, sim.data, sim.cs);
+	sim_HT1632C<> ht(bus);
+	
+	sim.reset_counters();
+	ht.initialize();
+	if(sim.transactions != 1 || sim.commands != 5 || !sim.sysen || !sim.ledon || sim.com_mode != HT1632C_CMD_COMS01){
+		hwlib::cout << "initialize is not one batch of 5 commands" << "\n";
+		exit(1);
+	}
+	uint32_t batched = sim.bits;
+	
+	sim.reset_counters();
+	ht.cmnd(HT1632C_CMD_SYSEN);
+	ht.cmnd(HT1632C_CMD_LEDON);
+	ht.cmnd(HT1632C_CMD_BLINKOFF);
+	ht.cmnd(HT1632C_CMD_INT_RC);
+	ht.cmnd(HT1632C_CMD_COMS01);
+	uint32_t single = sim.bits;
+	
+	sim.reset_counters();
+	ht.commands({ HT1632C_CMD_LEDOFF, HT1632C_CMD_BLINKON, HT1632C_CMD_PWMCONTROL | 0x3 });
+	if(sim.transactions != 1 || sim.commands != 3 || sim.ledon || !sim.blink || sim.pwm != 0x3){
+		hwlib::cout << "runtime command batch wrong" << "\n";
+		exit(1);
+	}
+	hwlib::cout << "initialize: " << batched << " bits in 1 transaction, one by one: " << single << " bits in 5 transactions" << "\n";
+	hwlib::cout << "passed" << "\n";
+}
+
+// CPU cycles from the time stamp counter, or nanoseconds on hosts without one.
+uint64_t host_cycles(){
+#if defined(__x86_64__) || defined(__i386__)
+	return __rdtsc();
+#else
+	return host_now_ns();
+#endif
+}
+
+// Compares the CPU cost per bit of three ways to send a full frame into the simulator:
+// writeData on virtual pins (the old flush), the encoded bitstream on virtual pins,
+// and the encoded bitstream on a bus with the concrete simulator pin type.
+void bench_emitter(){
+	using virtual_bus = basic_bus< hwlib::pin_in_out, hwlib::pin_in_out, hwlib::pin_in_out, timing_none >;
+	const int frames = 2000;
+	ht1632c_sim sim;
+	virtual_bus bus(sim.wr, sim.data, sim.cs);
+	sim_bus<> direct_bus(sim.wr, sim.data, sim.cs);
+	basic_HT1632C< virtual_bus > ht(bus);
+	sim_HT1632C<> direct(direct_bus);
+	uint16_t rows[HT1632C_LENGTH];
+	ht.initialize();
+	for(int y = 0; y < HT1632C_LENGTH; y++){
+		rows[y] = 0x9249 << (y % 3);
+		for(int x = 0; x < HT1632C_WIDTH; x++){
+			if(rows[y] & (0x8000 >> x)){
+				ht.setPixel(hwlib::xy(x, y));
+				direct.setPixel(hwlib::xy(x, y));
+			}
+		}
+	}
+	
+	uint64_t start = host_cycles();
+	for(int i = 0; i < frames; i++){
+		basic_writeTransaction< virtual_bus > command(bus);
+		command.writeData(HT1632C_ID_LEN, HT1632C_ID_WRITE);
+		command.writeData(HT1632C_ADDRESS_LEN, 0x00);
+		for(int y = 0; y < HT1632C_LENGTH; y++){
+			command.writeData(16, rows[y]);
+		}
+	}
+	uint64_t write_data = host_cycles() - start;
+	bool ok = leds_match(sim, rows);
+	
+	memset(sim.ram, 0, sizeof(sim.ram));
+	start = host_cycles();
+	for(int i = 0; i < frames; i++){
+		ht.flush_all();
+	}
+	uint64_t virtual_emit = host_cycles() - start;
+	ok = ok && leds_match(sim, rows);
+	
+	memset(sim.ram, 0, sizeof(sim.ram));
+	start = host_cycles();
+	for(int i = 0; i < frames; i++){
+		direct.flush_all();
+	}
+	uint64_t static_emit = host_cycles() - start;
+	ok = ok && leds_match(sim, rows);
+	
+	if(!ok){
+		hwlib::cout << "emitted frame does not match the buffer" << "\n";
+		exit(1);
+	}
+	uint64_t bits = uint64_t(frames) * HT1632C_FRAME_BITS;
+	hwlib::cout << "writeData, virtual pins: " << write_data * 100 / bits << " cycles/100 bits" << "\n";
+	hwlib::cout << "bitstream, virtual pins: " << virtual_emit * 100 / bits << " cycles/100 bits" << "\n";
+	hwlib::cout << "bitstream, simulator pin type: " << static_emit * 100 / bits << " cycles/100 bits" << "\n";
+	hwlib::cout << "passed" << "\n";
+}
+
+// Sets and clears single pixels immediately and checks that only one nibble is sent each time,
+// then checks that the flush planner picks single nibbles, merged runs or a full frame.
+void test_nibbles(){
+	ht1632c_sim sim;
+	sim_bus<> bus(sim.wr, sim.data, sim.cs);
+	sim_HT1632C<> ht(bus);
+	uint16_t rows[HT1632C_LENGTH] = {0};
+	ht.initialize();
+	ht.flush();
+	
+	sim.reset_counters();
+	ht.setPixelNow(hwlib::xy(5, 7));
+	rows[7] |= 0x8000 >> 5;
+	if(sim.bits != HT1632C_RUN_OVERHEAD + HT1632C_DATA_LEN || !leds_match(sim, rows)){
+		hwlib::cout << "setPixelNow did not send exactly one nibble" << "\n";
+		exit(1);
+	}
+	sim.reset_counters();
+	ht.setPixelNow(hwlib::xy(5, 7));
+	ht.flush();
+	if(sim.edges != 0){
+		hwlib::cout << "setting a pixel that is already on caused bus traffic" << "\n";
+		exit(1);
+	}
+	sim.reset_counters();
+	ht.clearPixelNow(hwlib::xy(5, 7));
+	rows[7] = 0;
+	if(sim.bits != HT1632C_RUN_OVERHEAD + HT1632C_DATA_LEN || !leds_match(sim, rows)){
+		hwlib::cout << "clearPixelNow did not send exactly one nibble" << "\n";
+		exit(1);
+	}
+	
+	// two nibbles with a gap of 2 are merged into one run of 4, a gap of 3 (rows 4 and 5) starts a new run
+	sim.reset_counters();
+	ht.setPixel(hwlib::xy(0, 2));
+	ht.setPixel(hwlib::xy(12, 2));
+	ht.setPixel(hwlib::xy(0, 4));
+	ht.setPixel(hwlib::xy(0, 5));
+	rows[2] = 0x8008; rows[4] = 0x8000; rows[5] = 0x8000;
+	ht.flush();
+	if(sim.transactions != 3 || sim.nibbles_written != 4 + 1 + 1 || !leds_match(sim, rows)){
+		hwlib::cout << "runs not planned right: " << sim.transactions << " transactions, " << sim.nibbles_written << " nibbles" << "\n";
+		exit(1);
+	}
+	
+	// changing every nibble costs as much as a full frame
+	sim.reset_counters();
+	for(int y = 0; y < HT1632C_LENGTH; y++){
+		for(int x = 0; x < HT1632C_WIDTH; x += 4){
+			ht.setPixel(hwlib::xy(x + 1, y));
+			rows[y] |= 0x8000 >> (x + 1);
+		}
+	}
+	ht.flush();
+	if(sim.transactions != 1 || sim.bits != HT1632C_FRAME_BITS || !leds_match(sim, rows)){
+		hwlib::cout << "planner did not fall back to a full frame" << "\n";
+		exit(1);
+	}
+	hwlib::cout << "single pixel: " << HT1632C_RUN_OVERHEAD + HT1632C_DATA_LEN << " bits, full frame: " << HT1632C_FRAME_BITS << " bits" << "\n";
+	hwlib::cout << "passed" << "\n";
+}
+
+// Reads the display RAM back, then injects faults in the simulator and checks that
+// only the wrong nibbles are sent again.
+void test_readback(){
+	ht1632c_sim sim;
+	sim_bus<> bus(sim.wr, sim.data, sim.cs, sim.rd);
+	sim_HT1632C<> ht(bus);
+	uint16_t rows[HT1632C_LENGTH] = {0};
+	ht.initialize();
+	for(int i = 0; i < HT1632C_LENGTH; i++){
+		hwlib::xy xy((i * 5) % HT1632C_WIDTH, i);
+		ht.setPixel(xy);
+		rows[i] |= 0x8000 >> xy.x;
+	}
+	ht.flush();
+	
+	sim.reset_counters();
+	uint8_t chip[HT1632C_ADDRESSES];
+	ht.readRam(0, HT1632C_ADDRESSES, chip);
+	if(memcmp(chip, sim.ram, sizeof(chip)) != 0 || sim.nibbles_read != HT1632C_ADDRESSES){
+		hwlib::cout << "readRam does not return the display RAM" << "\n";
+		exit(1);
+	}
+	if(sim.contention != 0){
+		hwlib::cout << "the data pin was still an output while the chip drove it" << "\n";
+		exit(1);
+	}
+	hwlib::cout << "read back: " << sim.bits << " bits written, " << sim.nibbles_read << " nibbles read" << "\n";
+	if(ht.verify() != 0){
+		hwlib::cout << "verify found errors on a good display" << "\n";
+		exit(1);
+	}
+	
+	// two corrupted nibbles are found by verify and repair sends only those
+	sim.corrupt(9, 0x5);
+	sim.corrupt(69, 0x0);
+	if(ht.verify() != 2){
+		hwlib::cout << "verify did not find the corrupted nibbles" << "\n";
+		exit(1);
+	}
+	sim.reset_counters();
+	int wrong = ht.repair();
+	if(wrong != 2 || sim.nibbles_written != 2 || !leds_match(sim, rows)){
+		hwlib::cout << "repair: " << wrong << " wrong, " << sim.nibbles_written << " nibbles sent" << "\n";
+		exit(1);
+	}
+	
+	// a glitched write is caught by verify-after-flush and sent again
+	ht.verify_writes(true);
+	sim.glitch(1);
+	ht.setPixel(hwlib::xy(3, 3));
+	rows[3] |= 0x8000 >> 3;
+	sim.reset_counters();
+	ht.flush();
+	if(!leds_match(sim, rows) || sim.nibbles_written != 2 || ht.verify() != 0){
+		hwlib::cout << "verify-after-flush did not fix the glitched nibble" << "\n";
+		exit(1);
+	}
+	ht.verify_writes(false);
+	
+	// after a brownout the commands are sent again and only the scrambled nibbles that differ are written
+	sim.brownout(7);
+	ht.initialize();
+	sim.reset_counters();
+	wrong = ht.repair();
+	if(!leds_match(sim, rows) || ht.verify() != 0 || !sim.sysen || !sim.ledon){
+		hwlib::cout << "repair after a brownout did not restore the display" << "\n";
+		exit(1);
+	}
+	hwlib::cout << "brownout: " << wrong << " wrong nibbles, " << sim.bits << " bits written" << "\n";
+	hwlib::cout << "passed" << "\n";
+}
+
+// Panels that share WR and DATA, every panel has its own simulator and its own CS.
+template< typename Timing, int N >
+struct panel_chain{
+	using chain_bus = basic_bus< sim_shared_line, sim_shared_line, ht1632c_sim::line, Timing >;
+	ht1632c_sim sims[N];
+	sim_shared_line wr, data;
+	std::vector< chain_bus > buses;
+	std::vector< basic_HT1632C< chain_bus > > panels;
+	
+	panel_chain(){
+		for(auto & sim : sims){
+			wr.add(sim.wr);
+			data.add(sim.data);
+		}
+		buses.reserve(N);
+		panels.reserve(N);
+		for(auto & sim : sims){
+			buses.emplace_back(wr, data, sim.cs);
+			panels.emplace_back(buses.back());
+		}
+	}
+	
+	void reset_counters(){
+		for(auto & sim : sims){
+			sim.reset_counters();
+		}
+	}
+};
+
+// Checks that every simulated panel shows its area of the logical framebuffer.
+template< typename Array, typename Chain >
+bool panels_match(const Array & screen, const Chain & chain, const panel_place * places, int n){
+	for(int i = 0; i < n; i++){
+		for(int py = 0; py < HT1632C_LENGTH; py++){
+			for(int px = 0; px < HT1632C_WIDTH; px++){
+				if(chain.sims[i].led(py, px) != screen.getPixel(places[i].logical(px, py))){
+					return false;
+				}
+			}
+		}
+	}
+	return true;
+}
+
+// Draws on four panels with four different rotations and checks what every panel shows,
+// and that a flush only talks to the panels that changed.
+void test_panels(){
+	panel_chain< timing_none, 4 > chain;
+	using chain_bus = panel_chain< timing_none, 4 >::chain_bus;
+	const panel_place places[4] = {
+		{ 0, 0, rotation::none },
+		{ 16, 0, rotation::cw90 },
+		{ 0, 24, rotation::cw180 },
+		{ 16, 16, rotation::cw270 }
+	};
+	basic_PanelArray< chain_bus, 4, 40, 48 > screen({
+		{ &chain.panels[0], places[0] },
+		{ &chain.panels[1], places[1] },
+		{ &chain.panels[2], places[2] },
+		{ &chain.panels[3], places[3] }
+	});
+	// the panels start with random RAM, like after power on
+	for(int i = 0; i < 4; i++){
+		chain.sims[i].brownout(i + 1);
+	}
+	screen.initialize();
+	for(auto & sim : chain.sims){
+		if(!sim.sysen || sim.com_mode != HT1632C_CMD_COMS01){
+			hwlib::cout << "not every panel got the initialize commands" << "\n";
+			exit(1);
+		}
+	}
+	
+	// the first flush reaches every panel, also the panels that nothing was drawn on
+	screen.setPixel(hwlib::xy(3, 3));
+	screen.flush();
+	for(int i = 1; i < 4; i++){
+		for(auto n : chain.sims[i].ram){
+			if(n){
+				hwlib::cout << "the first flush did not clear panel " << i << "\n";
+				exit(1);
+			}
+		}
+	}
+	if(!panels_match(screen, chain, places, 4)){
+		hwlib::cout << "the first flush did not send every panel its area" << "\n";
+		exit(1);
+	}
+	
+	for(int i = 0; i < 40; i++){
+		screen.setPixel(hwlib::xy(i, (i * 7) % 48));
+		screen.setPixel(hwlib::xy(39 - i, i));
+	}
+	screen.flush();
+	if(!panels_match(screen, chain, places, 4)){
+		hwlib::cout << "the panels do not show their area of the framebuffer" << "\n";
+		exit(1);
+	}
+	
+	// a pixel on the panel lying at the top right only reaches that panel
+	chain.reset_counters();
+	screen.setPixel(hwlib::xy(30, 2));
+	screen.flush();
+	if(chain.sims[1].nibbles_written != 1 || chain.sims[0].nibbles_written || chain.sims[2].nibbles_written
+		|| chain.sims[3].nibbles_written || !panels_match(screen, chain, places, 4)){
+		hwlib::cout << "a flush wrote to panels that did not change" << "\n";
+		exit(1);
+	}
+	chain.reset_counters();
+	screen.flush();
+	screen.clear();
+	screen.flush();
+	if(!panels_match(screen, chain, places, 4)){
+		hwlib::cout << "clear did not reach every panel" << "\n";
+		exit(1);
+	}
+	hwlib::cout << "passed" << "\n";
+}
+
+// Flushes an array of 8 panels with the datasheet timing, with a growing number of panels changed per frame.
+void bench_panels(){
+	const int frames = 10;
+	panel_chain< timing_datasheet, 8 > chain;
+	using chain_bus = panel_chain< timing_datasheet, 8 >::chain_bus;
+	typename basic_PanelArray< chain_bus, 8, 64, 48 >::slot slots[8];
+	for(int i = 0; i < 8; i++){
+		slots[i] = { &chain.panels[i], { int16_t(16 * (i % 4)), int16_t(24 * (i / 4)), rotation::none } };
+	}
+	basic_PanelArray< chain_bus, 8, 64, 48 > screen(slots);
+	screen.initialize();
+	screen.flush();
+	
+	for(int changed : { 0, 1, 2, 4, 8 }){
+		chain.reset_counters();
+		uint64_t total_ns = 0;
+		for(int f = 0; f < frames; f++){
+			for(int i = 0; i < changed; i++){
+				for(int y = 0; y < HT1632C_LENGTH; y++){
+					for(int x = 0; x < HT1632C_WIDTH; x++){
+						hwlib::xy xy(16 * (i % 4) + x, 24 * (i / 4) + y);
+						if(f & 1){
+							screen.clearPixel(xy);
+						} else {
+							screen.setPixel(xy);
+						}
+					}
+				}
+			}
+			uint64_t start = host_now_ns();
+			screen.flush();
+			total_ns += host_now_ns() - start;
+		}
+		uint32_t bits = 0;
+		for(auto & sim : chain.sims){
+			bits += sim.bits;
+		}
+		if(bits != uint32_t(changed * frames * HT1632C_FRAME_BITS)){
+			hwlib::cout << "unchanged panels were sent: " << bits << " bits" << "\n";
+			exit(1);
+		}
+		hwlib::cout << changed << " of 8 panels changed: " << total_ns / frames / 1000 << " us per frame, "
+			<< bits / frames << " bits per frame" << "\n";
+	}
+	hwlib::cout << "passed" << "\n";
+}
+
+// Reference for slice_row: one bit at a time.
+template< int N >
+void slice_row_naive(const uint16_t * rows, uint8_t * out){
+	for(int c = 0; c < 16; c++){
+		out[c] = 0;
+		for(int k = 0; k < N; k++){
+			if(rows[k] & (0x8000 >> c)){
+				out[c] |= 1 << k;
+			}
+		}
+	}
+}
+
+// N panels on one WR, one CS and a port with N DATA lines.
+template< int N, typename Timing = timing_none >
+struct sliced_chain{
+	ht1632c_sim sims[N];
+	sim_shared_line wr, cs;
+	sim_port port;
+	basic_sliced_HT1632C< sim_shared_line, sim_shared_line, sim_port, N, Timing > panels;
+	
+	sliced_chain():
+		panels( init(), cs, port )
+	{}
+	
+	sim_shared_line & init(){
+		for(auto & sim : sims){
+			wr.add(sim.wr);
+			cs.add(sim.cs);
+			port.add(sim.data);
+		}
+		return wr;
+	}
+};
+
+// Draws random pixels on N sliced panels and checks every simulator, and that a frame costs one WR toggle per bit.
+template< int N >
+void test_sliced_n(){
+	sliced_chain< N > chain;
+	uint16_t rows[N][HT1632C_LENGTH] = {};
+	chain.panels.initialize();
+	for(int k = 0; k < N; k++){
+		if(!chain.sims[k].sysen || !chain.sims[k].ledon || chain.sims[k].com_mode != HT1632C_CMD_COMS01){
+			hwlib::cout << "panel " << k << " of " << N << " did not get the initialize commands" << "\n";
+			exit(1);
+		}
+	}
+	srand(N);
+	for(int frame = 0; frame < 4; frame++){
+		for(int i = 0; i < 40; i++){
+			int k = rand() % N;
+			hwlib::xy xy(rand() % HT1632C_WIDTH, rand() % HT1632C_LENGTH);
+			if(rand() & 1){
+				chain.panels.setPixel(k, xy);
+				rows[k][xy.y] |= 0x8000 >> xy.x;
+			} else {
+				chain.panels.clearPixel(k, xy);
+				rows[k][xy.y] &= ~(0x8000 >> xy.x);
+			}
+		}
+		for(auto & sim : chain.sims){
+			sim.reset_counters();
+		}
+		chain.panels.flush();
+		for(int k = 0; k < N; k++){
+			if(!leds_match(chain.sims[k], rows[k])){
+				hwlib::cout << "panel " << k << " of " << N << " does not show its buffer" << "\n";
+				exit(1);
+			}
+			if(chain.sims[k].bits != chain.sims[0].bits){
+				hwlib::cout << "the panels did not get the same number of bits" << "\n";
+				exit(1);
+			}
+		}
+	}
+	
+	// a full frame is 394 WR toggles, no matter how many panels there are
+	chain.panels.setPixel(0, hwlib::xy(0, 0));
+	chain.panels.setPixel(0, hwlib::xy(0, 23));
+	rows[0][0] |= 0x8000;
+	rows[0][23] |= 0x8000;
+	for(auto & sim : chain.sims){
+		sim.reset_counters();
+	}
+	chain.panels.flush();
+	if(chain.sims[0].bits != HT1632C_FRAME_BITS || !leds_match(chain.sims[0], rows[0])){
+		hwlib::cout << "a full sliced frame took " << chain.sims[0].bits << " bits" << "\n";
+		exit(1);
+	}
+}
+
+template< int... Ns >
+void test_sliced_all(std::integer_sequence< int, Ns... >){
+	( test_sliced_n< Ns + 1 >(), ... );
+}
+
+// Checks the transpose against the bit by bit reference, then validates the sliced panels for N = 1 up to 8.
+void test_sliced(){
+	srand(14);
+	for(int i = 0; i < 1000; i++){
+		uint16_t rows[8];
+		for(auto & r : rows){
+			r = rand();
+		}
+		uint8_t fast[16], naive[16];
+		slice_row< 8 >(rows, fast);
+		slice_row_naive< 8 >(rows, naive);
+		if(memcmp(fast, naive, sizeof(fast)) != 0){
+			hwlib::cout << "slice_row does not match the reference" << "\n";
+			exit(1);
+		}
+	}
+	test_sliced_all(std::make_integer_sequence< int, 8 >());
+	hwlib::cout << "passed" << "\n";
+}
+
+// Benchmarks the transpose of a whole frame of 8 panels, and the time of a sliced frame against one panel.
+void bench_sliced(){
+#if defined(__x86_64__) || defined(__i386__)
+	uint16_t frame[24][8];
+	for(int y = 0; y < 24; y++){
+		for(int k = 0; k < 8; k++){
+			frame[y][k] = rand();
+		}
+	}
+	const int rounds = 10000;
+	uint8_t slices[24 * 16];
+	uint32_t check = 0;
+	uint64_t start = __rdtsc();
+	for(int r = 0; r < rounds; r++){
+		frame[r % 24][r % 8] ^= r;
+		for(int y = 0; y < 24; y++){
+			slice_row_naive< 8 >(frame[y], slices + 16 * y);
+		}
+		check += slices[r % sizeof(slices)];
+	}
+	uint64_t naive = (__rdtsc() - start) / rounds;
+	start = __rdtsc();
+	for(int r = 0; r < rounds; r++){
+		frame[r % 24][r % 8] ^= r;
+		for(int y = 0; y < 24; y++){
+			slice_row< 8 >(frame[y], slices + 16 * y);
+		}
+		check += slices[r % sizeof(slices)];
+	}
+	uint64_t fast = (__rdtsc() - start) / rounds;
+	hwlib::cout << "transpose of 8 frames, bit by bit: " << naive << " cycles, transpose8: " << fast
+		<< " cycles (" << (check & 1) << ")" << "\n";
+#endif
+	
+	sliced_chain< 1, timing_datasheet > one;
+	sliced_chain< 8, timing_datasheet > eight;
+	uint64_t times[2];
+	for(int i = 0; i < 2; i++){
+		uint64_t start_ns = host_now_ns();
+		if(i == 0){
+			one.panels.flush();
+		} else {
+			eight.panels.flush();
+		}
+		times[i] = host_now_ns() - start_ns;
+	}
+	hwlib::cout << "full frame to 1 panel: " << times[0] / 1000 << " us, to 8 panels: " << times[1] / 1000 << " us" << "\n";
+}
+
+// Draws through the hwlib window and checks the simulated LEDs, and that the row fast paths keep the bus traffic low.
+void test_window(){
+	ht1632c_sim sim;
+	sim_bus<> bus(sim.wr, sim.data, sim.cs);
+	sim_HT1632C<> ht(bus);
+	basic_matrix_window< sim_bus<> > w(ht);
+	uint16_t rows[HT1632C_LENGTH] = {0};
+	ht.initialize();
+	w.clear();
+	w.flush();
+	
+	w.write(hwlib::xy(3, 4));
+	w.write(hwlib::xy(20, 4));
+	rows[4] |= 0x8000 >> 3;
+	sim.reset_counters();
+	w.flush();
+	if(!leds_match(sim, rows) || sim.nibbles_written != 1){
+		hwlib::cout << "a window write did not become a single nibble" << "\n";
+		exit(1);
+	}
+	w.write(hwlib::xy(3, 4), hwlib::black);
+	rows[4] = 0;
+	
+	// horizontal, vertical and diagonal lines, clipped at the edges
+	w.draw_line(hwlib::xy(-3, 1), hwlib::xy(5, 1), hwlib::white);
+	rows[1] |= 0xFC00;
+	w.draw_line(hwlib::xy(15, 30), hwlib::xy(15, 20), hwlib::white);
+	for(int y = 20; y < 24; y++){
+		rows[y] |= 0x0001;
+	}
+	w.draw_line(hwlib::xy(2, 10), hwlib::xy(6, 14), hwlib::white);
+	for(int i = 0; i < 5; i++){
+		rows[10 + i] |= 0x8000 >> (2 + i);
+	}
+	w.draw_rectangle(hwlib::xy(8, 2), hwlib::xy(11, 5), hwlib::white);
+	rows[2] |= 0x00F0; rows[5] |= 0x00F0; rows[3] |= 0x0090; rows[4] |= 0x0090;
+	w.fill_rectangle(hwlib::xy(12, 16), hwlib::xy(4, 17), hwlib::white);
+	rows[16] |= 0x0FF8; rows[17] |= 0x0FF8;
+	w.fill_rectangle(hwlib::xy(5, 16), hwlib::xy(6, 16), hwlib::black);
+	rows[16] &= ~0x0600;
+	w.flush();
+	if(!leds_match(sim, rows)){
+		hwlib::cout << "the window shapes do not match" << "\n";
+		exit(1);
+	}
+	
+	// drawing what is already there is free
+	sim.reset_counters();
+	w.fill_rectangle(hwlib::xy(4, 17), hwlib::xy(12, 17), hwlib::white);
+	w.draw_line(hwlib::xy(0, 1), hwlib::xy(5, 1), hwlib::white);
+	w.flush();
+	if(sim.edges != 0){
+		hwlib::cout << "redrawing the same shapes caused bus traffic" << "\n";
+		exit(1);
+	}
+	
+	w.clear(hwlib::white);
+	w.flush();
+	for(auto & r : rows){
+		r = 0xFFFF;
+	}
+	if(!leds_match(sim, rows)){
+		hwlib::cout << "clear to white did not turn every LED on" << "\n";
+		exit(1);
+	}
+	w.clear();
+	w.flush();
+	for(auto & r : rows){
+		r = 0;
+	}
+	if(!leds_match(sim, rows)){
+		hwlib::cout << "clear did not turn every LED off" << "\n";
+		exit(1);
+	}
+	hwlib::cout << "passed" << "\n";
+}
+
+// Checks the word-mask primitives against pixel by pixel references, and that they only mark the touched rows.
+void test_shapes(){
+	ht1632c_sim sim;
+	sim_bus<> bus(sim.wr, sim.data, sim.cs);
+	sim_HT1632C<> ht(bus);
+	uint16_t rows[HT1632C_LENGTH] = {0};
+	ht.initialize();
+	ht.flush();
+	
+	ht.hline(hwlib::xy(-2, 3), 6);
+	rows[3] |= 0xF000;
+	ht.vline(hwlib::xy(9, 20), 10);
+	for(int y = 20; y < 24; y++){
+		rows[y] |= 0x8000 >> 9;
+	}
+	ht.fill_rect(hwlib::xy(12, 8), hwlib::xy(10, 3));
+	for(int y = 8; y < 11; y++){
+		rows[y] |= 0x000F;
+	}
+	ht.clear_rect(hwlib::xy(13, 9), hwlib::xy(2, 1));
+	rows[9] &= ~0x0006;
+	sim.reset_counters();
+	ht.flush();
+	// one nibble in row 3, one in rows 8 up to 10 and one in rows 20 up to 23
+	if(!leds_match(sim, rows) || sim.nibbles_written != 8){
+		hwlib::cout << "the shapes do not match or touched too much: " << sim.nibbles_written << " nibbles" << "\n";
+		exit(1);
+	}
+	
+	// shapes that change nothing mark nothing
+	sim.reset_counters();
+	ht.hline(hwlib::xy(0, 3), 4);
+	ht.clear_rect(hwlib::xy(0, 0), hwlib::xy(16, 2));
+	ht.flush();
+	if(sim.edges != 0){
+		hwlib::cout << "shapes that change nothing caused bus traffic" << "\n";
+		exit(1);
+	}
+	
+	// shifts and scrolls in all directions against a pixel by pixel reference
+	srand(16);
+	for(int i = 0; i < 200; i++){
+		bool wrap = rand() & 1;
+		direction d = direction(rand() % 4);
+		int n = rand() % 30;
+		uint16_t moved[HT1632C_LENGTH] = {0};
+		for(int y = 0; y < HT1632C_LENGTH; y++){
+			for(int x = 0; x < HT1632C_WIDTH; x++){
+				if(!(rows[y] & (0x8000 >> x))){
+					continue;
+				}
+				int nx = x + (d == direction::right ? n : d == direction::left ? -n : 0);
+				int ny = y + (d == direction::down ? n : d == direction::up ? -n : 0);
+				if(wrap){
+					nx = ((nx % HT1632C_WIDTH) + HT1632C_WIDTH) % HT1632C_WIDTH;
+					ny = ((ny % HT1632C_LENGTH) + HT1632C_LENGTH) % HT1632C_LENGTH;
+				}
+				if(nx >= 0 && nx < HT1632C_WIDTH && ny >= 0 && ny < HT1632C_LENGTH){
+					moved[ny] |= 0x8000 >> nx;
+				}
+			}
+		}
+		if(wrap){
+			ht.scroll(d, n);
+		} else {
+			ht.shift(d, n);
+		}
+		memcpy(rows, moved, sizeof(rows));
+		ht.flush();
+		if(!leds_match(sim, rows)){
+			hwlib::cout << (wrap ? "scroll" : "shift") << " by " << n << " does not match" << "\n";
+			exit(1);
+		}
+		if(i % 20 == 0){
+			ht.fill_rect(hwlib::xy(rand() % 16, rand() % 24), hwlib::xy(5, 7));
+			ht.invert();
+			for(int y = 0; y < HT1632C_LENGTH; y++){
+				rows[y] = ht.getRow(y);
+			}
+		}
+	}
+	hwlib::cout << "passed" << "\n";
+}
+
+// Compares a scroll and a wipe with the word-mask primitives against setPixel loops.
+void bench_shapes(){
+#if defined(__x86_64__) || defined(__i386__)
+	ht1632c_sim sim;
+	sim_bus<> bus(sim.wr, sim.data, sim.cs);
+	sim_HT1632C<> ht(bus);
+	const int rounds = 10000;
+	uint64_t start = __rdtsc();
+	for(int r = 0; r < rounds; r++){
+		ht.scroll(direction::left);
+	}
+	uint64_t scroll = (__rdtsc() - start) / rounds;
+	start = __rdtsc();
+	for(int r = 0; r < rounds; r++){
+		ht.fill_rect(hwlib::xy(0, 0), hwlib::xy(r % 17, HT1632C_LENGTH));
+		ht.clear_rect(hwlib::xy(r % 17, 0), hwlib::xy(HT1632C_WIDTH, HT1632C_LENGTH));
+	}
+	uint64_t wipe = (__rdtsc() - start) / rounds;
+	start = __rdtsc();
+	for(int r = 0; r < rounds; r++){
+		for(int y = 0; y < HT1632C_LENGTH; y++){
+			for(int x = 0; x < HT1632C_WIDTH; x++){
+				if(x < r % 17){
+					ht.setPixel(hwlib::xy(x, y));
+				} else {
+					ht.clearPixel(hwlib::xy(x, y));
+				}
+			}
+		}
+	}
+	uint64_t pixels = (__rdtsc() - start) / rounds;
+	hwlib::cout << "scroll: " << scroll << " cycles, wipe with fill_rect: " << wipe
+		<< " cycles, wipe with setPixel: " << pixels << " cycles" << "\n";
+#endif
+}
+
+// Runs random drawing on a panel with the given geometry and checks every LED of the simulator against a pixel grid.
+template< typename Geometry >
+void test_geometry_on(const char * name){
+	constexpr int w = Geometry::width, h = Geometry::height;
+	ht1632c_sim sim;
+	sim_bus<> bus(sim.wr, sim.data, sim.cs);
+	basic_HT1632C< sim_bus<>, Geometry > ht(bus);
+	bool grid[h][w] = {};
+	ht.initialize();
+	if(sim.com_mode != Geometry::com_mode || sim.ram_size() != Geometry::addresses){
+		hwlib::cout << name << ": initialize did not select the COM mode of the geometry" << "\n";
+		exit(1);
+	}
+	sim.reset_counters();
+	ht.flush();
+	if(sim.bits != uint32_t(Geometry::frame_bits)){
+		hwlib::cout << name << ": the first frame is " << sim.bits << " bits" << "\n";
+		exit(1);
+	}
+	
+	constexpr auto arrow = make_sprite( "..X..", ".XXX.", "X.X.X", "..X.." );
+	srand(18);
+	for(int i = 0; i < 400; i++){
+		int x = rand() % (w + 8) - 4, y = rand() % (h + 8) - 4;
+		int op = rand() % 6;
+		if(op == 0 || op == 1){
+			if(x >= 0 && x < w && y >= 0 && y < h){
+				grid[y][x] = op == 0;
+			}
+			if(op == 0) ht.setPixel(hwlib::xy(x, y)); else ht.clearPixel(hwlib::xy(x, y));
+		} else if(op == 2){
+			int sw = rand() % 10, sh = rand() % 10;
+			bool on = rand() & 1;
+			for(int j = y; j < y + sh; j++){
+				for(int k = x; k < x + sw; k++){
+					if(k >= 0 && k < w && j >= 0 && j < h){
+						grid[j][k] = on;
+					}
+				}
+			}
+			if(on) ht.fill_rect(hwlib::xy(x, y), hwlib::xy(sw, sh)); else ht.clear_rect(hwlib::xy(x, y), hwlib::xy(sw, sh));
+		} else if(op == 3){
+			blit_mode mode = blit_mode(rand() % 3);
+			for(int j = 0; j < arrow.height; j++){
+				for(int k = 0; k < arrow.width; k++){
+					int gx = x + k, gy = y + j;
+					if(gx < 0 || gx >= w || gy < 0 || gy >= h){
+						continue;
+					}
+					bool lit = arrow.rows[j] & (0x8000 >> k);
+					if(mode == blit_mode::set){
+						grid[gy][gx] |= lit;
+					} else if(mode == blit_mode::replace){
+						grid[gy][gx] = lit;
+					} else {
+						grid[gy][gx] ^= lit;
+					}
+				}
+			}
+			ht.blit(arrow, x, y, mode);
+		} else {
+			direction d = direction(rand() % 4);
+			int n = rand() % 5;
+			bool wrap = op == 5;
+			bool moved[h][w] = {};
+			for(int j = 0; j < h; j++){
+				for(int k = 0; k < w; k++){
+					if(!grid[j][k]){
+						continue;
+					}
+					int nx = k + (d == direction::right ? n : d == direction::left ? -n : 0);
+					int ny = j + (d == direction::down ? n : d == direction::up ? -n : 0);
+					if(wrap){
+						nx = (nx + w) % w;
+						ny = (ny + h) % h;
+					}
+					if(nx >= 0 && nx < w && ny >= 0 && ny < h){
+						moved[ny][nx] = true;
+					}
+				}
+			}
+			memcpy(grid, moved, sizeof(grid));
+			if(wrap) ht.scroll(d, n); else ht.shift(d, n);
+		}
+		ht.flush();
+		for(int j = 0; j < h; j++){
+			for(int k = 0; k < w; k++){
+				bool led = Geometry::transposed ? sim.led(k, j) : sim.led(j, k);
+				if(led != grid[j][k] || ht.getPixel(hwlib::xy(k, j)) != grid[j][k]){
+					hwlib::cout << name << ": pixel " << k << ", " << j << " is wrong after operation " << op << "\n";
+					exit(1);
+				}
+			}
+		}
+	}
+	hwlib::cout << name << ": " << Geometry::addresses << " nibbles, driver of " << sizeof(ht) << " bytes" << "\n";
+}
+
+// Checks the default panel, a 32 by 8 board in the 8 COM mode and a panel on its side.
+void test_geometry(){
+	test_geometry_on< geometry_16x24 >("16x24, 16 COM");
+	test_geometry_on< geometry_32x8 >("32x8, 8 COM");
+	test_geometry_on< ht1632c_geometry< 24, 16, HT1632C_CMD_COMS01 > >("24x16, 16 COM");
+	hwlib::cout << "passed" << "\n";
+}
+
+// Checks the button queue: the events of a script, a full queue, and a thread that stands in for the interrupt handler.
+void test_buttons(){
+	basic_button_input< 4 > small;
+	small.sample(BUTTON_STEEN_P1, 10);
+	small.sample(BUTTON_STEEN_P1 | BUTTON_PAPIER_P2, 20);
+	small.sample(BUTTON_PAPIER_P2, 30);
+	button_event event;
+	if(!small.next(event) || event.stamp != 10 || event.pressed != BUTTON_STEEN_P1 || event.released || event.state != BUTTON_STEEN_P1){
+		hwlib::cout << "the first event is wrong" << "\n";
+		exit(1);
+	}
+	if(!small.next(event) || event.stamp != 20 || event.pressed != BUTTON_PAPIER_P2 || event.released){
+		hwlib::cout << "the second event is wrong" << "\n";
+		exit(1);
+	}
+	if(!small.next(event) || event.pressed || event.released != BUTTON_STEEN_P1 || small.next(event)){
+		hwlib::cout << "the release is wrong" << "\n";
+		exit(1);
+	}
+	
+	// a press and release between two drains is still reported once, after that only what is held down
+	small.sample(BUTTON_PAPIER_P2 | BUTTON_SCHAAR_P1, 40);
+	small.sample(BUTTON_PAPIER_P2, 50);
+	if(small.buttons() != (BUTTON_PAPIER_P2 | BUTTON_SCHAAR_P1) || small.buttons() != BUTTON_PAPIER_P2){
+		hwlib::cout << "a short press is lost" << "\n";
+		exit(1);
+	}
+	
+	// a full queue drops a change, the next sample is compared with the last accepted state
+	for(int i = 0; i < 6; i++){
+		small.sample(i & 1 ? BUTTON_PAPIER_P2 : 0, 60 + i);
+	}
+	if(small.dropped() != 1 || small.buttons() != BUTTON_PAPIER_P2){
+		hwlib::cout << "a full queue gives " << small.dropped() << " dropped changes" << "\n";
+		exit(1);
+	}
+	small.sample(BUTTON_STEEN_P2, 70);
+	if(small.buttons() != BUTTON_STEEN_P2){
+		hwlib::cout << "the queue does not recover after it was full" << "\n";
+		exit(1);
+	}
+	
+	// a thread pushes numbers as fast as it can, the other side has to get all of them in order
+	constexpr uint32_t count = 100000;
+	spsc_queue< uint32_t, 64 > numbers;
+	std::thread producer([&]{
+		for(uint32_t i = 1; i <= count; i++){
+			while(!numbers.push(i)){
+				std::this_thread::yield();
+			}
+		}
+	});
+	uint32_t expected = 1;
+	while(expected <= count){
+		uint32_t n;
+		if(numbers.pop(n)){
+			if(n != expected){
+				hwlib::cout << "got " << n << " instead of " << expected << "\n";
+				exit(1);
+			}
+			expected++;
+		} else {
+			std::this_thread::yield();
+		}
+	}
+	producer.join();
+	
+	// the thread plays the interrupt handler and never waits, every event has to fit the one before it
+	basic_button_input< 16 > input;
+	std::atomic< bool > done{ false };
+	std::thread isr([&]{
+		srand(19);
+		for(uint32_t stamp = 1; stamp <= count; stamp++){
+			input.sample(rand() & 0x3f, stamp);
+			if(stamp % 8 == 0){
+				std::this_thread::yield();
+			}
+		}
+		done = true;
+	});
+	uint8_t state = 0;
+	uint32_t stamp = 0, events = 0;
+	for(;;){
+		bool finished = done;
+		while(input.next(event)){
+			if(event.stamp <= stamp || event.pressed != (event.state & ~state) || event.released != (state & ~event.state)){
+				hwlib::cout << "event " << event.stamp << " does not fit the one before it" << "\n";
+				exit(1);
+			}
+			state = event.state;
+			stamp = event.stamp;
+			events++;
+		}
+		if(finished){
+			break;
+		}
+		std::this_thread::yield();
+	}
+	isr.join();
+	hwlib::cout << events << " events, " << input.dropped() << " dropped while the main loop was busy" << "\n";
+	
+	// a press that ends during a flush: polling after the flush misses it, the queue does not
+	ht1632c_sim sim;
+	sim_bus< timing_datasheet > bus(sim.wr, sim.data, sim.cs);
+	sim_HT1632C< timing_datasheet > ht(bus);
+	button_input queued;
+	std::atomic< uint8_t > pin{ 0 };
+	std::atomic< bool > flushing{ false };
+	std::thread press([&]{
+		while(!flushing){
+			std::this_thread::yield();
+		}
+		pin = BUTTON_STEEN_P1;
+		queued.sample(pin, 1);
+		pin = 0;
+		queued.sample(pin, 2);
+	});
+	flushing = true;
+	ht.flush_all();
+	press.join();
+	uint8_t polled = pin;
+	if(polled != 0 || queued.buttons() != BUTTON_STEEN_P1){
+		hwlib::cout << "the press during the flush is lost" << "\n";
+		exit(1);
+	}
+	hwlib::cout << "passed" << "\n";
+}
+
+// The wiring of the game: port and bit of every button, in the order of the BUTTON_ masks.
+// d7 up to d4 are PC23 up to PC26, d3 is PC28 and d2 is PB25.
+const uint8_t button_ports[6] = { 2, 2, 2, 2, 2, 1 };
+const uint8_t button_bits[6] = { 23, 24, 25, 26, 28, 25 };
+
+// A button read through the pin interface from a simulated port register, like the old six read calls.
+class port_bit_pin : public hwlib::pin_in_out{
+protected:
+	const volatile uint32_t & word;
+	uint32_t bit;
+public:
+	port_bit_pin(const volatile uint32_t & word, uint32_t bit):
+		word( word ),
+		bit( bit )
+	{}
+	bool read() override{
+		return word & bit;
+	}
+	void write(bool) override{}
+	void direction_set_input() override{}
+	void direction_set_output() override{}
+	void direction_flush() override{}
+	void refresh() override{}
+	void flush() override{}
+};
+
+// Checks the port gather against the wiring and the debounce against scripted bounce patterns.
+void test_debounce(){
+	port_fields fields;
+	for(int b = 0; b < 6; b++){
+		fields.add(button_ports[b], button_bits[b], b);
+	}
+	srand(20);
+	for(int i = 0; i < 10000; i++){
+		uint32_t words[4] = { uint32_t(rand()) ^ (uint32_t(rand()) << 16), uint32_t(rand()) ^ (uint32_t(rand()) << 16),
+			uint32_t(rand()) ^ (uint32_t(rand()) << 16), uint32_t(rand()) ^ (uint32_t(rand()) << 16) };
+		uint8_t expected = 0;
+		for(int b = 0; b < 6; b++){
+			if(words[button_ports[b]] & (0x1U << button_bits[b])){
+				expected |= 1 << b;
+			}
+		}
+		if(fields.gather(words) != expected || fields.ports() != 0x6){
+			hwlib::cout << "the gathered buttons do not match the port words" << "\n";
+			exit(1);
+		}
+	}
+	
+	// every button gets presses and releases that bounce for up to 12 samples with stable times of 1 up to 3 samples
+	// between the bounces, every change has to come through exactly once, 4 samples after the contact is stable
+	vertical_debounce debounce;
+	int presses[6] = {}, releases[6] = {}, expected_presses[6] = {};
+	int level[6] = {}, next_change[6] = {}, bounces[6] = {}, stable_since[6] = {};
+	bool settled[6] = {};
+	int max_latency = 0, min_latency = 1000;
+	for(int t = 0; t < 200000; t++){
+		uint8_t sample = 0;
+		for(int b = 0; b < 6; b++){
+			if(t == next_change[b]){
+				if(bounces[b] == 0){
+					bounces[b] = rand() % 7 * 2 + 1;
+				}
+				level[b] ^= 1;
+				bounces[b]--;
+				if(bounces[b] == 0){
+					stable_since[b] = t;
+					settled[b] = false;
+					if(level[b]){
+						expected_presses[b]++;
+					}
+					next_change[b] = t + 10 + rand() % 40;
+				} else {
+					next_change[b] = t + 1 + rand() % 3;
+				}
+			}
+			sample |= level[b] << b;
+		}
+		debounce.update(sample);
+		for(int b = 0; b < 6; b++){
+			bool pressed = debounce.pressed() & (1 << b), released = debounce.released() & (1 << b);
+			if(!pressed && !released){
+				continue;
+			}
+			if(bounces[b] != 0 || settled[b] || pressed != bool(level[b])){
+				hwlib::cout << "button " << b << " changed during a bounce at sample " << t << "\n";
+				exit(1);
+			}
+			settled[b] = true;
+			int latency = t - stable_since[b] + 1;
+			max_latency = latency > max_latency ? latency : max_latency;
+			min_latency = latency < min_latency ? latency : min_latency;
+			presses[b] += pressed;
+			releases[b] += released;
+		}
+	}
+	for(int b = 0; b < 6; b++){
+		if(presses[b] != expected_presses[b] || releases[b] < presses[b] - 1 || releases[b] > presses[b]){
+			hwlib::cout << "button " << b << ": " << presses[b] << " presses instead of " << expected_presses[b] << "\n";
+			exit(1);
+		}
+	}
+	if(min_latency != 4 || max_latency != 4){
+		hwlib::cout << "the latency is " << min_latency << " up to " << max_latency << " samples" << "\n";
+		exit(1);
+	}
+	hwlib::cout << presses[0] + presses[1] + presses[2] + presses[3] + presses[4] + presses[5]
+		<< " bouncing presses, each reported once after " << max_latency << " stable samples" << "\n";
+	hwlib::cout << "passed" << "\n";
+}
+
+// Scanning the buttons: six reads through the pin interface against one read per port and the gather,
+// both followed by the debounce.
+void bench_scan(){
+	volatile uint32_t ports[4] = {};
+	port_bit_pin pins[6] = {
+		{ ports[button_ports[0]], 0x1U << button_bits[0] }, { ports[button_ports[1]], 0x1U << button_bits[1] },
+		{ ports[button_ports[2]], 0x1U << button_bits[2] }, { ports[button_ports[3]], 0x1U << button_bits[3] },
+		{ ports[button_ports[4]], 0x1U << button_bits[4] }, { ports[button_ports[5]], 0x1U << button_bits[5] }
+	};
+	hwlib::pin_in_out * buttons[6] = { &pins[0], &pins[1], &pins[2], &pins[3], &pins[4], &pins[5] };
+	port_fields fields;
+	for(int b = 0; b < 6; b++){
+		fields.add(button_ports[b], button_bits[b], b);
+	}
+	vertical_debounce debounce;
+	const int rounds = 100000;
+	uint32_t changes = 0;
+	uint64_t start = host_cycles();
+	for(int r = 0; r < rounds; r++){
+		ports[2] = r << 20;
+		uint8_t sample = 0;
+		for(int b = 0; b < 6; b++){
+			if(buttons[b]->read()) sample |= 1 << b;
+		}
+		changes += debounce.update(sample);
+	}
+	uint64_t single = (host_cycles() - start) / rounds;
+	start = host_cycles();
+	for(int r = 0; r < rounds; r++){
+		ports[2] = r << 20;
+		uint32_t words[4];
+		words[1] = ports[1];
+		words[2] = ports[2];
+		changes += debounce.update(fields.gather(words));
+	}
+	uint64_t batched = (host_cycles() - start) / rounds;
+	hwlib::cout << "scan and debounce, six pin reads: " << single << " cycles, two port reads: " << batched
+		<< " cycles (" << changes % 2 << ")" << "\n";
+}
+
+// Applies a random drawing operation to two drivers.
+template< typename A, typename B >
+void random_draw(A & a, B & b){
+	hwlib::xy pos(rand() % 20 - 2, rand() % 28 - 2), size(rand() % 8, rand() % 8);
+	switch(rand() % 4){
+		case 0: a.setPixel(pos); b.setPixel(pos); break;
+		case 1: a.clearPixel(pos); b.clearPixel(pos); break;
+		case 2: a.fill_rect(pos, size); b.fill_rect(pos, size); break;
+		default: a.clear_rect(pos, size); b.clear_rect(pos, size); break;
+	}
+}
+
+int async_completed = 0;
+
+// Runs frames through a background flush with random tick sizes, and draws while the transfers run.
+// Every transfer has to leave the chip like a normal flush of the same frame, with the same bits.
+void test_async(){
+	ht1632c_sim sim_a, sim_b;
+	sim_bus<> bus_a(sim_a.wr, sim_a.data, sim_a.cs), bus_b(sim_b.wr, sim_b.data, sim_b.cs);
+	basic_async_HT1632C< sim_bus<> > a(bus_a);
+	sim_HT1632C<> b(bus_b);
+	a.initialize();
+	b.initialize();
+	a.on_complete([]{ async_completed++; });
+	srand(21);
+	int started = 0, merged = 0;
+	uint32_t ticks = 0;
+	for(int frame = 0; frame < 500; frame++){
+		for(int i = rand() % 6; i > 0; i--){
+			random_draw(a, b);
+		}
+		uint32_t bits_a = sim_a.bits, bits_b = sim_b.bits;
+		b.flush();
+		if(!a.flush_async()){
+			if(sim_b.bits != bits_b){
+				hwlib::cout << "frame " << frame << " was not started" << "\n";
+				exit(1);
+			}
+			continue;
+		}
+		started++;
+		if(sim_a.bits != bits_a){
+			hwlib::cout << "flush_async sent bits before the first tick" << "\n";
+			exit(1);
+		}
+		while(a.busy()){
+			if(a.flush_async()){
+				hwlib::cout << "a transfer was started while one was running" << "\n";
+				exit(1);
+			}
+			a.tick(1 + rand() % 40);
+			ticks++;
+			if(rand() % 8 == 0){
+				random_draw(a, b);
+				merged++;
+			}
+		}
+		if(memcmp(sim_a.ram, sim_b.ram, sizeof(sim_a.ram)) || sim_a.bits - bits_a != sim_b.bits - bits_b){
+			hwlib::cout << "frame " << frame << " differs from a normal flush" << "\n";
+			exit(1);
+		}
+	}
+	if(async_completed != started){
+		hwlib::cout << "the callback was called " << async_completed << " times for " << started << " transfers" << "\n";
+		exit(1);
+	}
+	a.flush_async();
+	a.finish();
+	b.flush();
+	if(memcmp(sim_a.ram, sim_b.ram, sizeof(sim_a.ram)) || a.busy()){
+		hwlib::cout << "the changes made during the transfers are lost" << "\n";
+		exit(1);
+	}
+	hwlib::cout << started << " transfers in " << ticks << " ticks, " << merged << " changes merged into the next transfer" << "\n";
+	hwlib::cout << "passed" << "\n";
+}
+
+// How long the main loop waits for a full frame: with flush, and with flush_async where the bits are sent by ticks.
+void bench_async(){
+	ht1632c_sim sim;
+	sim_bus< timing_datasheet > bus(sim.wr, sim.data, sim.cs);
+	basic_async_HT1632C< sim_bus< timing_datasheet > > ht(bus);
+	const int rounds = 200;
+	uint64_t sync = 0, async = 0, ticks = 0;
+	for(int r = 0; r < rounds; r++){
+		ht.fill_rect(hwlib::xy(0, 0), hwlib::xy(HT1632C_WIDTH, HT1632C_LENGTH));
+		uint64_t start = host_now_ns();
+		ht.flush();
+		sync += host_now_ns() - start;
+		ht.clear();
+		start = host_now_ns();
+		ht.flush_async();
+		async += host_now_ns() - start;
+		while(ht.tick(8)){
+			ticks++;
+		}
+		ticks++;
+	}
+	hwlib::cout << "full frame, flush: " << sync / rounds / 1000 << " us in the main loop, flush_async: "
+		<< async / rounds << " ns in the main loop and " << ticks / rounds << " ticks of 8 bits" << "\n";
+}
+
+// A serial port that takes a number of characters and then is busy, like a UART at a low baud rate.
+struct string_sink{
+	std::string text;
+	int budget = 0;
+	bool ready() const {
+		return budget > 0;
+	}
+	void put(char c){
+		text += c;
+		budget--;
+	}
+};
+
+// Checks the lines of the deferred log, draining a few characters at a time, the drop count and the levels.
+void test_log(){
+	basic_log< 4 > log;
+	string_sink sink;
+	LOG_INFO(log, "Player 1 has chosen");
+	LOG_WARN(log, "Display repaired, wrong nibbles:", 89);
+	LOG_ERROR(log, "value", -12);
+	int evaluated = 0;
+	LOG_DEBUG(log, "not logged", ++evaluated);
+	LOG_INFO(log, "a text that is much longer than one line of the log can hold, so it is cut", ++evaluated);
+	if(evaluated != 1){
+		hwlib::cout << "a disabled level evaluated its arguments" << "\n";
+		exit(1);
+	}
+	int drains = 0;
+	for(;;){
+		sink.budget = 3;
+		drains++;
+		if(log.drain(sink)){
+			break;
+		}
+	}
+	// the last text is cut to fit the line of 64 characters, the newline stays
+	const char * expected[4] = {
+		" I Player 1 has chosen\n", " W Display repaired, wrong nibbles: 89\n", " E value -12\n", " I a text that"
+	};
+	size_t at = 0;
+	for(int i = 0; i < 4; i++){
+		size_t end = sink.text.find('\n', at);
+		std::string line = sink.text.substr(at, end + 1 - at);
+		std::string tail = line.substr(line.find(' '));
+		bool right = i < 3 ? tail == expected[i] : tail.compare(0, strlen(expected[i]), expected[i]) == 0 && line.size() == 64;
+		if(end == std::string::npos || !right){
+			hwlib::cout << "wrong log line: " << line.c_str();
+			exit(1);
+		}
+		if(line[line.find('.') + 4] != ' '){
+			hwlib::cout << "the time is not in milliseconds: " << line.c_str();
+			exit(1);
+		}
+		at = end + 1;
+	}
+	if(at != sink.text.size() || drains < int(sink.text.size() / 3)){
+		hwlib::cout << "the log was not sent a few characters at a time" << "\n";
+		exit(1);
+	}
+	
+	// a full queue drops records, the number is reported once the queue is empty
+	sink.text.clear();
+	for(int i = 0; i < 10; i++){
+		LOG_INFO(log, "record", i);
+	}
+	sink.budget = 1000;
+	log.drain(sink);
+	if(log.dropped() != 6 || sink.text.find("log dropped 6\n") == std::string::npos
+	 || sink.text.find("record 3\n") == std::string::npos || sink.text.find("record 4\n") != std::string::npos){
+		hwlib::cout << "wrong drop report: " << sink.text.c_str();
+		exit(1);
+	}
+	
+	// a stamp after 2^32 us, about 71 minutes, does not wrap
+	struct stamped_log : basic_log< 4 >{
+		std::string line_of(uint64_t stamp_us){
+			format(log_record{ "late", 0, stamp_us, LOG_LEVEL_INFO, false });
+			return std::string(line, length);
+		}
+	} late;
+	if(late.line_of(5000123456ULL) != "5000.123 I late\n"){
+		hwlib::cout << "a late stamp wrapped: " << late.line_of(5000123456ULL).c_str();
+		exit(1);
+	}
+	hwlib::cout << "passed" << "\n";
+}
+
+// Adding a record against writing the same line through a blocking serial port at 9600 baud.
+void bench_log(){
+	deferred_log log;
+	string_sink sink;
+	const int rounds = 100000;
+	uint64_t start = host_now_ns();
+	for(int r = 0; r < rounds; r++){
+		LOG_INFO(log, "Player 1 has chosen");
+		if(r % 16 == 15){
+			sink.text.clear();
+			sink.budget = 1 << 20;
+			log.drain(sink);
+		}
+	}
+	uint64_t add = (host_now_ns() - start) / rounds;
+	sink.text.clear();
+	LOG_INFO(log, "Player 1 has chosen");
+	log.drain(sink);
+	hwlib::cout << "a deferred record: " << add << " ns including the drain, a blocking line of " << sink.text.size()
+		<< " characters at 9600 baud: " << sink.text.size() * 10 * 1000 / 9600 << " ms" << "\n";
+}
+
+// The counters of the driver have to agree with what the simulator saw on the bus,
+// for the normal and the background flush. Ends with the dump of a simulated game session.
+void test_stats(){
+	ht1632c_sim sim;
+	sim_bus<> bus(sim.wr, sim.data, sim.cs);
+	basic_async_HT1632C< sim_bus<> > ht(bus);
+	ht1632c_stats.reset();
+	ht.initialize();
+	ht.clear();
+	ht.flush();
+	ht.flush();
+	srand(23);
+	for(int frame = 0; frame < 200; frame++){
+		for(int i = rand() % 6; i > 0; i--){
+			random_draw(ht, ht);
+		}
+		if(frame % 2){
+			ht.flush();
+		} else if(ht.flush_async()){
+			while(ht.tick(1 + rand() % 40)){}
+		}
+	}
+	if(ht1632c_stats.bits_sent != sim.bits || ht1632c_stats.transactions != sim.transactions
+	 || ht1632c_stats.commands != sim.commands){
+		hwlib::cout << "the counters do not match the bus: " << ht1632c_stats.bits_sent << " bits, " << ht1632c_stats.transactions
+			<< " transactions, " << ht1632c_stats.commands << " commands against " << sim.bits << ", " << sim.transactions
+			<< ", " << sim.commands << "\n";
+		exit(1);
+	}
+	uint32_t flushes = ht1632c_stats.full_flushes + ht1632c_stats.partial_flushes + ht1632c_stats.empty_flushes;
+	if(ht1632c_stats.clears != 1 || ht1632c_stats.full_flushes < 1 || ht1632c_stats.empty_flushes < 1 || flushes < 100
+	 || ht1632c_stats.flush_us.count != 102){
+		hwlib::cout << "wrong flush counters" << "\n";
+		exit(1);
+	}
+	
+	// a long idle run saves nothing and takes the per-iteration counters past 32 bits
+	ht1632c_stats.reset();
+	const uint64_t start = 0xFFFFFFFFU - 1000;
+	ht1632c_stats.empty_flushes = ht1632c_stats.loop_iterations = ht1632c_stats.flush_us.count = start;
+	for(int i = 0; i < 100000; i++){
+		HT1632C_STATS_ADD(loop_iterations, 1);
+		ht.flush();
+		ht.flush_async();
+	}
+	if(ht1632c_stats.bits_saved != 0 || ht1632c_stats.bits_sent != 0 || ht1632c_stats.empty_flushes != start + 200000
+	 || ht1632c_stats.loop_iterations != start + 100000 || ht1632c_stats.flush_us.count != start + 100000){
+		hwlib::cout << "idle flushes are counted wrong: " << ht1632c_stats.bits_saved << " bits saved, "
+			<< ht1632c_stats.empty_flushes << " empty flushes" << "\n";
+		exit(1);
+	}
+	
+	log2_histogram h;
+	for(uint32_t v : { 0U, 1U, 2U, 3U, 4U, 1000U, 0xFFFFFFFFU }){
+		h.add(v);
+	}
+	if(h.buckets[0] != 1 || h.buckets[1] != 1 || h.buckets[2] != 2 || h.buckets[3] != 1 || h.buckets[10] != 1
+	 || h.buckets[32] != 1 || h.min != 0 || h.max != 0xFFFFFFFF || h.count != 7){
+		hwlib::cout << "wrong histogram buckets" << "\n";
+		exit(1);
+	}
+	
+	// a game session: the buttons are sampled every loop, a choice is timed until the transfer that shows it is done
+	ht1632c_stats.reset();
+	button_input input;
+	game round(20000, 1000);
+	uint32_t choice_stamp = 0;
+	bool choice_waiting = false, choice_sending = false;
+	uint64_t last_loop = host_now_ns();
+	for(uint32_t loop = 0; loop < 20000; loop++){
+		HT1632C_STATS_ADD(loop_iterations, 1);
+		HT1632C_STATS_VALUE(loop_us, uint32_t((host_now_ns() - last_loop) / 1000));
+		last_loop = host_now_ns();
+		input.sample(loop % 500 < 50 ? uint8_t(0x1 << (loop / 500 % 6)) : 0, uint32_t(host_now_ns() / 1000));
+		game_events events = round.update(loop * 10, input.buttons());
+		if(events.p1_chosen || events.p2_chosen){
+			choice_stamp = input.pressed_at();
+			choice_waiting = true;
+			ht.setPixel(hwlib::xy(rand() % 16, rand() % 24));
+		}
+		if(ht.flush_async() && choice_waiting){
+			choice_waiting = false;
+			choice_sending = true;
+		}
+		ht.tick(8);
+		if(choice_sending && !ht.busy()){
+			HT1632C_STATS_VALUE(latency_us, uint32_t(host_now_ns() / 1000) - choice_stamp);
+			choice_sending = false;
+		}
+	}
+	if(ht1632c_stats.loop_iterations != 20000 || ht1632c_stats.loop_us.count != 20000 || ht1632c_stats.latency_us.count == 0){
+		hwlib::cout << "the session was not measured" << "\n";
+		exit(1);
+	}
+	ht1632c_stats.dump(hwlib::cout);
+	hwlib::cout << "passed" << "\n";
+}
+
+// trace clock whose ticks are nanoseconds, for traces with hand made stamps
+struct ns_clock{
+	static void start(){}
+	static uint32_t now(){ return 0; }
+	static uint64_t ns(uint64_t ticks){ return ticks; }
+};
+
+// Analyzes a hand made transaction with known violations and checks its VCD, then traces flushes and
+// a read back of the simulator: the analyzer has to count the same bits and transactions as the simulator,
+// without violations for the profile the bus was clocked with.
+void test_trace(){
+	pin_trace< 16, ns_clock > made;
+	// CS low, a bit with a short setup and a short WR low, a bit that is fine, CS high too soon
+	const trace_edge edges[] = {
+		{ 1000, TRACE_CS, 0 }, { 1200, TRACE_WR, 0 }, { 1300, TRACE_DATA, 1 }, { 1500, TRACE_WR, 1 },
+		{ 3200, TRACE_WR, 0 }, { 3300, TRACE_DATA, 0 }, { 5000, TRACE_WR, 1 }, { 5100, TRACE_CS, 1 },
+		{ 8000, TRACE_CS, 0 }, { 9000, TRACE_CS, 1 }
+	};
+	for(auto & e : edges){
+		made.record(e.pin, e.level, e.stamp);
+	}
+	trace_report r = analyze_trace< timing_datasheet >(made);
+	if(r.transactions != 2 || r.bits_written != 2 || r.cs_setup != 1 || r.wr_low != 1 || r.data_setup != 1
+	 || r.wr_high != 0 || r.cs_hold != 1 || r.busy_ns != 5100 || r.gap_ns.count != 1 || r.gap_ns.max != 2900){
+		hwlib::cout << "wrong analysis of a hand made trace" << "\n";
+		r.print(hwlib::cout);
+		exit(1);
+	}
+	std::ostringstream vcd;
+	write_vcd(made, vcd, { "wr", "data", "cs" });
+	const char * expected =
+		"$timescale 1ns $end\n$scope module ht1632c $end\n"
+		"$var wire 1 ! wr $end\n$var wire 1 \" data $end\n$var wire 1 # cs $end\n"
+		"$upscope $end\n$enddefinitions $end\n#0\n$dumpvars\nx!\nx\"\nx#\n$end\n"
+		"0#\n#200\n0!\n#300\n1\"\n#500\n1!\n#2200\n0!\n#2300\n0\"\n#4000\n1!\n#4100\n1#\n#7000\n0#\n#8000\n1#\n";
+	if(vcd.str() != expected){
+		hwlib::cout << "wrong VCD:" << "\n" << vcd.str();
+		exit(1);
+	}
+	
+	// the ring buffer keeps the last edges
+	for(int i = 0; i < 20; i++){
+		made.record(TRACE_WR, i & 1, 10000 + i);
+	}
+	if(made.size() != 16 || made.overwritten() != 14 || made[0].stamp != 10004 || made[15].stamp != 10019){
+		hwlib::cout << "the ring buffer does not keep the last edges" << "\n";
+		exit(1);
+	}
+	
+	ht1632c_sim sim;
+	using traced = trace_pin< pin_trace< 1 << 16 >, ht1632c_sim::line >;
+	pin_trace< 1 << 16 > & trace = *new pin_trace< 1 << 16 >;
+	traced wr(sim.wr, trace, TRACE_WR), data(sim.data, trace, TRACE_DATA), cs(sim.cs, trace, TRACE_CS), rd(sim.rd, trace, TRACE_RD);
+	basic_bus< traced, traced, traced, timing_datasheet, traced > bus(wr, data, cs, rd);
+	basic_HT1632C< basic_bus< traced, traced, traced, timing_datasheet, traced > > ht(bus);
+	ht.initialize();
+	srand(24);
+	for(int frame = 0; frame < 10; frame++){
+		random_draw(ht, ht);
+		ht.flush();
+	}
+	uint8_t chip[HT1632C_ADDRESSES];
+	ht.readRam(0, HT1632C_ADDRESSES, chip);
+	r = analyze_trace< timing_datasheet >(trace);
+	if(r.transactions != sim.transactions || r.bits_written != sim.bits || r.bits_read != sim.nibbles_read * 4
+	 || r.violations() != 0 || trace.overwritten() != 0){
+		hwlib::cout << "the analysis does not match the simulator: " << sim.transactions << " transactions, " << sim.bits
+			<< " bits, " << sim.nibbles_read << " nibbles read" << "\n";
+		r.print(hwlib::cout);
+		exit(1);
+	}
+	r.print(hwlib::cout);
+	delete &trace;
+	hwlib::cout << "passed" << "\n";
+}
+
+// Traces a full frame clocked without delays and checks it against the datasheet profile:
+// this is what a bus speed-up that goes too far looks like.
+void bench_trace(){
+	ht1632c_sim sim;
+	using traced = trace_pin< pin_trace< 4096 >, ht1632c_sim::line >;
+	static pin_trace< 4096 > trace;
+	traced wr(sim.wr, trace, TRACE_WR), data(sim.data, trace, TRACE_DATA), cs(sim.cs, trace, TRACE_CS);
+	basic_bus< traced, traced, traced, timing_none > bus(wr, data, cs);
+	basic_HT1632C< basic_bus< traced, traced, traced, timing_none > > ht(bus);
+	ht.flush_all();
+	trace.clear();
+	ht.flush_all();
+	trace_report r = analyze_trace< timing_datasheet >(trace);
+	r.print(hwlib::cout);
+	if(r.bits_written != sim.bits / 2 || r.wr_low == 0){
+		hwlib::cout << "the violations of a bus without delays are not found" << "\n";
+		exit(1);
+	}
+	std::ostringstream vcd;
+	write_vcd(trace, vcd);
+	hwlib::cout << trace.size() << " edges, " << vcd.str().size() << " bytes of VCD" << "\n";
+}
+
+// Shows a gray image for a number of whole periods and adds up how long every LED was on, weighted with the duty of the chip.
+// Every pixel has to get exactly the weight of its level. The schedule repeats, so the periods can start at any slot.
+template< typename Gray >
+bool gray_matches(Gray & gray, ht1632c_sim & sim, int periods){
+	static uint32_t on[HT1632C_LENGTH][HT1632C_WIDTH];
+	memset(on, 0, sizeof(on));
+	for(int t = periods * gray.period(); t > 0; t--){
+		gray.tick();
+		for(int y = 0; y < HT1632C_LENGTH; y++){
+			for(int x = 0; x < HT1632C_WIDTH; x++){
+				on[y][x] += sim.led(y, x) ? sim.pwm + 1 : 0;
+			}
+		}
+	}
+	for(int y = 0; y < HT1632C_LENGTH; y++){
+		for(int x = 0; x < HT1632C_WIDTH; x++){
+			if(on[y][x] != gray.weight(gray.getLevel(hwlib::xy(x, y))) * periods){
+				return false;
+			}
+		}
+	}
+	return true;
+}
+
+// Runs gray images through the plane scheduler, with time weighting only and with PWM weighted planes,
+// changes the image while the planes are shown and checks that the switches only send the nibbles that differ.
+template< int Bits, int PwmPlanes >
+void test_grayscale_on(){
+	const int pwm_planes = PwmPlanes;
+	ht1632c_sim sim;
+	sim_bus<> bus(sim.wr, sim.data, sim.cs);
+	basic_grayscale_HT1632C< sim_bus<>, geometry_16x24, Bits, PwmPlanes > gray(bus);
+	gray.initialize();
+	for(int y = 0; y < HT1632C_LENGTH; y++){
+		for(int x = 0; x < HT1632C_WIDTH; x++){
+			gray.setLevel(hwlib::xy(x, y), (x + y) % gray.levels);
+		}
+	}
+	if(!gray.flush_planes() || gray.flush_planes() || !gray_matches(gray, sim, 3)){
+		hwlib::cout << Bits << " bits, " << pwm_planes << " PWM planes: the LEDs do not show the levels" << "\n";
+		exit(1);
+	}
+	uint32_t weights = 0;
+	for(int level = 1; level < gray.levels; level++){
+		if(gray.weight(level) <= gray.weight(level - 1)){
+			hwlib::cout << "level " << level << " is not brighter than the level below" << "\n";
+			exit(1);
+		}
+		weights += gray.weight(level) - gray.weight(level - 1);
+	}
+	
+	// a change halfway a period is taken at the next switch, from the plane that is on the chip,
+	// only the switches after that are counted
+	for(int i = 0; i < 5; i++){
+		gray.tick();
+	}
+	gray.clearLevels();
+	for(int i = 0; i < 8; i++){
+		gray.setLevel(hwlib::xy(i, 2 * i), gray.levels - 1 - i % gray.levels);
+	}
+	gray.flush_planes();
+	for(uint32_t n = gray.switched(); gray.switched() == n;){
+		gray.tick();
+	}
+	sim.reset_counters();
+	if(!gray_matches(gray, sim, 2)){
+		hwlib::cout << Bits << " bits, " << pwm_planes << " PWM planes: a change while showing is wrong" << "\n";
+		exit(1);
+	}
+	if(sim.bits >= uint32_t(2 * Bits * 394) || gray.switched() == 0){
+		hwlib::cout << "the switches of a sparse image are not partial: " << sim.bits << " bits" << "\n";
+		exit(1);
+	}
+	hwlib::cout << Bits << " bits, " << pwm_planes << " PWM planes: period " << gray.period() << " slots, "
+		<< sim.bits / 2 << " bits per period for 8 pixels, steps of " << weights / (gray.levels - 1) << "\n";
+}
+
+void test_grayscale(){
+	// the datasheet timing is rejected: a full frame every switch gives 35 Hz in the shortest period
+	static_assert( ht1632c_gray_refresh_hz< timing_datasheet, geometry_16x24 >(2, true) == 35
+		&& ht1632c_gray_refresh_hz< timing_none, geometry_16x24 >(15, false) >= HT1632C_GRAY_MIN_REFRESH,
+		"the worst case refresh of a gray configuration is wrong" );
+	test_grayscale_on< 2, 0 >();
+	test_grayscale_on< 3, 0 >();
+	test_grayscale_on< 4, 0 >();
+	test_grayscale_on< 2, 1 >();
+	test_grayscale_on< 3, 2 >();
+	test_grayscale_on< 4, 1 >();
+	hwlib::cout << "passed" << "\n";
+}
+
+// Times the plane switches of a random gray image as they would take on a bus with the datasheet timing.
+// A switch runs in the timer interrupt and the plane is half written while it runs, so a switch may only take
+// a share of the slot: the tick rate where the slowest switch takes HT1632C_GRAY_SWITCH_SHARE of a slot sets the plane and refresh rates.
+// While a switch runs the LEDs are neither the old nor the new plane, that is up to Bits switches per period of error,
+// given as a part of the full brightness and in steps of the lowest level.
+// The driver rejects the datasheet timing, the worst case it checks is shown next to the random image:
+// the switches run on a bus without delays and their datasheet time is taken from the bits and transactions
+// they put on the bus. The host time is shown as well but can be disturbed by the scheduler of the host.
+template< int Bits, int PwmPlanes >
+void bench_grayscale_on(){
+	using timing = timing_datasheet;
+	const int pwm_planes = PwmPlanes;
+	const uint64_t share = HT1632C_GRAY_SWITCH_SHARE;
+	ht1632c_sim sim;
+	sim_bus<> bus(sim.wr, sim.data, sim.cs);
+	basic_grayscale_HT1632C< sim_bus<>, geometry_16x24, Bits, PwmPlanes > gray(bus);
+	gray.initialize();
+	srand(25);
+	for(int y = 0; y < HT1632C_LENGTH; y++){
+		for(int x = 0; x < HT1632C_WIDTH; x++){
+			gray.setLevel(hwlib::xy(x, y), rand() % gray.levels);
+		}
+	}
+	gray.flush_planes();
+	for(uint32_t n = gray.switched(); gray.switched() == n;){
+		gray.tick();
+	}
+	uint64_t worst = 0, total = 0, slowest = 0;
+	uint32_t switches = 0;
+	for(int t = 4 * gray.period(); t > 0; t--){
+		uint32_t bits = sim.bits, transactions = sim.transactions;
+		uint64_t start = host_now_ns();
+		if(gray.tick()){
+			uint64_t ns = host_now_ns() - start;
+			uint64_t bus_ns = uint64_t(sim.bits - bits) * (timing::wr_low_ns + timing::wr_high_ns)
+				+ uint64_t(sim.transactions - transactions) * (timing::cs_setup_ns + timing::cs_hold_ns);
+			worst = ns > worst ? ns : worst;
+			slowest = bus_ns > slowest ? bus_ns : slowest;
+			total += ns;
+			switches++;
+		}
+	}
+	uint64_t slot_ns = slowest * share;
+	uint64_t tick_rate = 1000000000ULL / slot_ns;
+	// error of Bits switches in a period, in 1/1000 of the full brightness and of the lowest level
+	uint64_t error = Bits * slowest * 1000 / (gray.period() * slot_ns);
+	uint64_t full = gray.period() * 16;
+	uint64_t steps = error * full / gray.weight(1);
+	hwlib::cout << Bits << " bits, " << pwm_planes << " PWM planes: slowest switch " << slowest / 1000 << " us on the bus (host "
+		<< total / switches / 1000 << " us mean, " << worst / 1000 << " us worst)" << "\n";
+	hwlib::cout << "  switch at 1/" << share << " of a slot: tick " << tick_rate << " Hz, "
+		<< tick_rate * Bits / gray.period() << " planes/s, " << tick_rate / gray.period() << " Hz refresh, error up to "
+		<< error / 10 << "." << error % 10 << "% of full, " << steps / 1000 << "." << steps / 100 % 10 << steps / 10 % 10 << " steps of the lowest level" << "\n";
+	uint32_t worst_case = ht1632c_gray_refresh_hz< timing, geometry_16x24 >(gray.period(), PwmPlanes > 0);
+	hwlib::cout << "  worst case, a full frame every switch: " << worst_case << " Hz refresh, "
+		<< (worst_case >= HT1632C_GRAY_MIN_REFRESH ? "accepted" : "rejected") << " for the datasheet timing" << "\n";
+	hwlib::cout << "  brightness of the levels in %:";
+	for(int level = 0; level < gray.levels; level++){
+		uint32_t permille = gray.weight(level) * 1000 / full;
+		hwlib::cout << " " << permille / 10 << "." << permille % 10;
+	}
+	hwlib::cout << "\n";
+}
+
+void bench_grayscale(){
+	bench_grayscale_on< 2, 0 >();
+	bench_grayscale_on< 3, 0 >();
+	bench_grayscale_on< 4, 0 >();
+	bench_grayscale_on< 2, 1 >();
+	bench_grayscale_on< 3, 2 >();
+	bench_grayscale_on< 4, 3 >();
+}
+
+int main(void){
+	hwlib::cout << "================= TIMING PROFILE BENCHMARK =================" << "\n";
+	bench_timing< timing_datasheet >("datasheet");
+	bench_timing< timing_conservative >("conservative");
+	bench_timing< timing_none >("none");
+	hwlib::cout << "================= SIMULATOR TEST =================" << "\n";
+	test_simulator();
+	hwlib::cout << "================= COMMAND BATCH TEST =================" << "\n";
+	test_commands();
+	hwlib::cout << "================= DIRTY ROW FLUSH TEST =================" << "\n";
+	test_dirty_flush();
+	hwlib::cout << "================= SPRITE BLIT TEST =================" << "\n";
+	test_blit();
+	hwlib::cout << "================= DOUBLE BUFFER SWAP TEST =================" << "\n";
+	test_swap();
+	hwlib::cout << "================= SINGLE NIBBLE AND PLANNER TEST =================" << "\n";
+	test_nibbles();
+	hwlib::cout << "================= READ BACK TEST =================" << "\n";
+	test_readback();
+	hwlib::cout << "================= PANEL ARRAY TEST =================" << "\n";
+	test_panels();
+	hwlib::cout << "================= PANEL ARRAY BENCHMARK =================" << "\n";
+	bench_panels();
+	hwlib::cout << "================= BIT-SLICED PANELS TEST =================" << "\n";
+	test_sliced();
+	hwlib::cout << "================= BIT-SLICED PANELS BENCHMARK =================" << "\n";
+	bench_sliced();
+	hwlib::cout << "================= HWLIB WINDOW TEST =================" << "\n";
+	test_window();
+	hwlib::cout << "================= WORD-MASK SHAPES TEST =================" << "\n";
+	test_shapes();
+	hwlib::cout << "================= WORD-MASK SHAPES BENCHMARK =================" << "\n";
+	bench_shapes();
+	hwlib::cout << "================= GEOMETRY AND COM MODE TEST =================" << "\n";
+	test_geometry();
+	hwlib::cout << "================= BACKGROUND FLUSH TEST =================" << "\n";
+	test_async();
+	hwlib::cout << "================= BACKGROUND FLUSH BENCHMARK =================" << "\n";
+	bench_async();
+	hwlib::cout << "================= BITSTREAM EMITTER BENCHMARK =================" << "\n";
+	bench_emitter();
+	hwlib::cout << "================= GAME STATE MACHINE TEST =================" << "\n";
+	test_game();
+	hwlib::cout << "================= BUTTON EVENT QUEUE TEST =================" << "\n";
+	test_buttons();
+	hwlib::cout << "================= PORT SCAN AND DEBOUNCE TEST =================" << "\n";
+	test_debounce();
+	hwlib::cout << "================= PORT SCAN BENCHMARK =================" << "\n";
+	bench_scan();
+	hwlib::cout << "================= DEFERRED LOG TEST =================" << "\n";
+	test_log();
+	hwlib::cout << "================= DEFERRED LOG BENCHMARK =================" << "\n";
+	bench_log();
+	hwlib::cout << "================= INSTRUMENTATION COUNTERS TEST =================" << "\n";
+	test_stats();
+	hwlib::cout << "================= PIN TRACE TEST =================" << "\n";
+	test_trace();
+	hwlib::cout << "================= PIN TRACE BENCHMARK =================" << "\n";
+	bench_trace();
+	hwlib::cout << "================= GRAYSCALE BIT-PLANES TEST =================" << "\n";
+	test_grayscale();
+	hwlib::cout << "================= GRAYSCALE BIT-PLANES BENCHMARK =================" << "\n";
+	bench_grayscale();
+	hwlib::cout << "================= IDLE POLLING BENCHMARK =================" << "\n";
+	bench_polling();
+	return 0;
+}
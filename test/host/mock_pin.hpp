@@ -0,0 +1,63 @@
+#ifndef MOCK_PIN_HPP
+#define MOCK_PIN_HPP
+#include "hwlib.hpp"
+#include <chrono>
+#include <vector>
+
+/// @file
+
+/// \brief
+/// A recorded pin edge
+/// \details
+/// time_ns is the host time of the edge, pin is the id given to the mock pin
+/// and level is the new level of the pin.
+struct pin_edge{
+    uint64_t time_ns;
+    uint8_t pin;
+    bool level;
+};
+
+/// \brief
+/// host time in nanoseconds
+inline uint64_t host_now_ns(){
+    return std::chrono::duration_cast< std::chrono::nanoseconds >(
+        std::chrono::steady_clock::now().time_since_epoch() ).count();
+}
+
+/// \brief
+/// Mock pin
+/// \details
+/// A pin that only exists on the host.
+/// Every time the level changes, the edge is appended to a shared log with a timestamp.
+/// The log should be reserved up front, so the timing is not disturbed by allocations.
+/// The pin starts high, like the idle HT1632C lines.
+class mock_pin : public hwlib::pin_in_out{
+protected:
+    std::vector< pin_edge > & log;
+    uint8_t id;
+    bool level = true;
+public:
+    mock_pin(std::vector< pin_edge > & log, uint8_t id):
+        log( log ),
+        id( id )
+    {}
+
+    void write(bool v) override{
+        if(v != level){
+            log.push_back({ host_now_ns(), id, v });
+        }
+        level = v;
+    }
+
+    bool read() override{
+        return level;
+    }
+
+    void direction_set_input() override{}
+    void direction_set_output() override{}
+    void direction_flush() override{}
+    void refresh() override{}
+    void flush() override{}
+};
+
+#endif
@@ -101,6 +101,8 @@ protected:
     hwlib::pin_in_out &write;
     hwlib::pin_in_out &data;
     hwlib::pin_in_out &cs;
+    char bits[512];
+    int count = 0;
     friend class bus;
 public:
     writeTransaction(bus &b):
@@ -117,14 +119,20 @@ public:
         for (uint16_t b = 1<<(byte_length-1); b; b >>= 1) {
             write.write(0);
             data.write((a & b) ? 1 : 0);
-			hwlib::cout << data.read()<< " "; 
+            if(count < int(sizeof(bits))){
+                bits[count++] = data.read() ? '1' : '0';
+            }
             hwlib::wait_ms(1);
             write.write(1);
         }
     }
 	
+// The bits are printed after CS goes high, printing them in writeData would change the timing of the bits.
     ~writeTransaction(){
         cs.write(1);
+        for(int i = 0; i < count; i++){
+            hwlib::cout << bits[i] << " ";
+        }
     }
 };
 